@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef BATCH_IO_HH
+#define BATCH_IO_HH
+
+#include <string>
+#include <vector>
+#include <streambuf>
+
+#include <sys/types.h>
+
+/**
+ * A batch of file writes and syncs
+ *
+ * Operations are queued and performed in order when the batch is
+ * submitted. If divetools was built with liburing, the whole batch is
+ * handed to the kernel as one chain of io_uring requests, which
+ * replaces a system call per operation with one system call per
+ * batch. Otherwise, or if io_uring isn't available at run time, the
+ * operations are performed using plain POSIX calls.
+ *
+ * Data passed to write() must remain valid until submit() returns.
+ */
+class IoBatch {
+public:
+    IoBatch();
+    ~IoBatch();
+
+    /**
+     * Queue a write
+     *
+     * @param offset Offset in the file, or -1 to write at the current
+     *               file position (e.g., for pipes)
+     * @param name File name used in error messages
+     */
+    void write(int fd, const void *data, unsigned int size, off_t offset,
+	       const std::string &name);
+    /** Queue a sync of all data written to a file so far */
+    void sync(int fd, bool dataOnly, const std::string &name);
+
+    /** Perform all queued operations, throws a DiveStoreException */
+    void submit();
+
+    /** Number of queued operations */
+    unsigned int size() const { return ops.size(); }
+
+private:
+    IoBatch(const IoBatch &);
+    IoBatch &operator=(const IoBatch &);
+
+    enum OpType {
+	OP_WRITE,
+	OP_SYNC,
+	OP_DATASYNC,
+    };
+
+    struct Op {
+	OpType type;
+	int fd;
+	const char *data;
+	unsigned int size;
+	off_t offset;
+	std::string name;
+    };
+
+    void performPosix(Op &op);
+    bool submitUring(unsigned int &first);
+
+    std::vector<Op> ops;
+
+    /** io_uring instance, created on first use */
+    struct io_uring *uring;
+    bool uringFailed;
+};
+
+/**
+ * Output buffer writing through an IoBatch
+ *
+ * Output is collected in large chunks which are written to the file
+ * descriptor in batches. Use it in place of the buffer of an ostream,
+ * e.g., std::cout. Flushing the stream doesn't write anything, call
+ * flush() once the output is complete.
+ */
+class BatchOutputBuf
+    : public std::streambuf
+{
+public:
+    BatchOutputBuf(int fd, const std::string &name,
+		   unsigned int chunkSize = 64 * 1024,
+		   unsigned int batchChunks = 16);
+    /** Writes any buffered output, errors are ignored */
+    ~BatchOutputBuf();
+
+    /** Write all buffered output, throws a DiveStoreException */
+    void flush();
+
+protected:
+    int_type overflow(int_type c);
+    int sync();
+
+private:
+    void nextChunk();
+
+    const int fd;
+    const std::string name;
+    const unsigned int chunkSize;
+    const unsigned int batchChunks;
+
+    IoBatch batch;
+    /** First write error, reported by flush() */
+    std::string error;
+
+    std::vector<std::vector<char> > chunks;
+    /** Number of chunks in use, the last one is being filled */
+    unsigned int used;
+};
+
+/**
+ * Total number of queued I/O operations and of the system calls that
+ * were used to perform them, updated by all threads.
+ */
+unsigned long batchIoOperations();
+unsigned long batchIoSyscalls();
+
+/** Number of system calls saved by batching, 0 if there weren't any */
+unsigned long batchIoSaved();
+
+/** True if divetools was built with io_uring support */
+bool haveIoUring();
+
+#endif
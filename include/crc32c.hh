@@ -28,42 +28,23 @@
  * OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "serialize/sample.hh"
 
-SampleBuilder::SampleBuilder()
-{
-}
+#ifndef CRC32C_HH
+#define CRC32C_HH
 
-SampleBuilder::~SampleBuilder()
-{
-}
+#include <stddef.h>
+#include <stdint.h>
 
-void
-SampleBuilder::onBeginSample()
-{
-    sample = Sample();
-}
-
-void
-SampleBuilder::onEndSample()
-{
-    onSample(sample);
-}
-
-void
-SampleBuilder::onTime(dcxx::Duration time)
-{
-    sample.time = time;
-}
+/**
+ * CRC-32C (Castagnoli) checksum
+ *
+ * Pass 0 as the initial crc, or the result of a previous call to
+ * continue a checksum. The SSE 4.2 crc32 instruction is used if the
+ * CPU supports it, otherwise a table driven implementation.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t size);
 
-void
-SampleBuilder::onDepth(dcxx::Length depth)
-{
-    sample.depth = depth;
-}
+/** True if crc32c() uses the crc32 instruction */
+bool haveHardwareCrc32c();
 
-void
-SampleBuilder::onTemperature(dcxx::Temperature temp)
-{
-    sample.temperature = temp;
-}
+#endif
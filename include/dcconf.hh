@@ -54,6 +54,10 @@ public:
 	devSerial = serial; devSerialValid = true;
     }
 
+    void setDevDelay(unsigned int serial, unsigned int delay) {
+	devDelaySerial = serial; devDelay = delay; devDelayValid = true;
+    }
+
     boost::program_options::options_description cfgCommon;
     boost::program_options::options_description optsCommon;
 
@@ -61,6 +65,23 @@ public:
     const DeviceInfo *devInfo;
     unsigned int devSerial;
     bool devSerialValid;
+
+    /**
+     * Tuned delay between commands in ms, only valid for the device
+     * with the serial number it was tuned for. The serial number is
+     * the one reported by the device driver, which isn't necessarily
+     * the same as devSerial.
+     */
+    unsigned int devDelay;
+    unsigned int devDelaySerial;
+    bool devDelayValid;
+
+    /** Dive storage format, see storeCreate() */
+    std::string storeFormat;
+    /** Shared object directory for content addressed storage */
+    std::string storeObjects;
+    /** Compress stored dives */
+    bool storeCompress;
 };
 
 std::ostream &operator<<(std::ostream & out, const DCConf &conf);
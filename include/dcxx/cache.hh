@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DCXX_CACHE_HH
+#define DCXX_CACHE_HH
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+#include <dcxx/utils.hh>
+
+DCXX_BEGIN_NS_DC
+
+/**
+ * Cache of device memory in aligned pages
+ *
+ * Device::read() serves reads from the cache when the cache has been
+ * enabled and reads missing pages from the device. Writes invalidate
+ * the pages they touch. The page size should be a multiple of the
+ * device's transfer size and divide the size of its memory, since
+ * reads are extended to whole pages.
+ */
+class PageCache {
+public:
+    PageCache();
+
+    /** Set the page size and drop all pages, 0 disables the cache */
+    void setPageSize(unsigned int size);
+    unsigned int getPageSize() const { return pageSize; }
+    bool isEnabled() const { return pageSize != 0; }
+
+    /** Return a cached page, or NULL if it isn't cached */
+    const unsigned char *find(unsigned int page) const;
+    /** Store a page of getPageSize() bytes */
+    void insert(unsigned int page, const unsigned char *data);
+
+    /** Drop all pages overlapping a memory range */
+    void invalidate(unsigned int addr, unsigned int size);
+    void clear();
+
+    /** Account for a page served from the cache */
+    void hit() { hits++; }
+    /** Account for a page read from the device */
+    void miss() { misses++; }
+
+    unsigned long getHits() const { return hits; }
+    unsigned long getMisses() const { return misses; }
+
+private:
+    typedef std::map<unsigned int, std::vector<unsigned char> > PageMap;
+
+    unsigned int pageSize;
+    PageMap pages;
+
+    unsigned long hits;
+    unsigned long misses;
+};
+
+DCXX_END_NS
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DCXX_DEADLINE_HH
+#define DCXX_DEADLINE_HH
+
+#include <stdint.h>
+
+#include <dcxx/utils.hh>
+
+DCXX_BEGIN_NS_DC
+
+/**
+ * Time budget of a device session
+ *
+ * The session is given a total time and a time per dive, which is
+ * measured from the start of the session or the previous dive. Use
+ * expired() from DeviceCallbacks::onCancel() to end the session with
+ * DEVICE_STATUS_CANCELLED when either runs out.
+ */
+class Deadline {
+public:
+    Deadline();
+
+    /** Limit the time of the whole session, 0 for no limit */
+    void setTotal(unsigned int seconds) { total = seconds * 1000000ULL; }
+    /** Limit the time per dive, 0 for no limit */
+    void setPerDive(unsigned int seconds) { perDive = seconds * 1000000ULL; }
+
+    bool isLimited() const { return total || perDive; }
+
+    /** Start the session */
+    void start();
+    /** A dive has been received, restart the time per dive */
+    void progress();
+
+    bool expired();
+    /** Describe which limit expired */
+    const char *what() const;
+
+private:
+    uint64_t total;
+    uint64_t perDive;
+
+    uint64_t started;
+    uint64_t lastProgress;
+
+    enum { NONE, TOTAL, PER_DIVE } reason;
+};
+
+DCXX_END_NS
+
+#endif
@@ -31,7 +31,12 @@
 #ifndef DCXX_DEVICE_HH
 #define DCXX_DEVICE_HH
 
+#include <string>
+#include <vector>
+
 #include <dcxx/utils.hh>
+#include <dcxx/cache.hh>
+#include <dcxx/stats.hh>
 #include <libdivecomputer/device.h>
 
 
@@ -47,16 +52,50 @@ DCXX_BEGIN_NS_DC
 class DeviceException {
 public:
     DeviceException(device_status_t status);
+    /** An error with a more specific description than the status */
+    DeviceException(device_status_t status, const std::string &msg);
 
     const char *what() const throw();
     device_status_t getStatus() const throw();
 
 private:
     const device_status_t status;
+    std::string msg;
 };
 
 class Device;
 
+/** A memory range for Device::readv() */
+struct ReadRange {
+    ReadRange(unsigned int _addr, unsigned int _size, void *_data)
+	: addr(_addr), size(_size), data(_data) {}
+
+    unsigned int addr;
+    unsigned int size;
+    void *data;
+};
+
+/**
+ * How a Device recovers from failed transfers
+ *
+ * Reads and downloads that fail with a timeout, protocol or I/O error
+ * are retried after a delay that doubles for every retry. Reads made
+ * through Device::read() only retry the failed block. Downloads using
+ * libdivecomputer's device_foreach() can't be resumed, a retry starts
+ * over and transfers the dives received so far once more.
+ */
+struct RetryPolicy {
+    RetryPolicy()
+	: retries(0), initialDelay(100), maxDelay(5000) {}
+
+    /** Number of times a failed transfer is retried */
+    unsigned int retries;
+    /** Time before the first retry, in ms */
+    unsigned int initialDelay;
+    /** Upper limit of the time between retries, in ms */
+    unsigned int maxDelay;
+};
+
 class DeviceCallbacks {
 public:
     DeviceCallbacks() {}
@@ -68,6 +107,15 @@ public:
     virtual void onEventDevInfo(Device &device, const device_devinfo_t &info) {}
     virtual void onEventClock(Device &device, const device_clock_t &clock) {}
 
+    /**
+     * A transfer failed and will be retried
+     *
+     * @param attempt Number of the retry, starting at 1
+     * @param delay Time until the retry in ms
+     */
+    virtual void onRetry(Device &device, const DeviceException &error,
+			 unsigned int attempt, unsigned int delay) {}
+
     /** Return true to cancel */
     virtual bool onCancel(Device &device) { return false; }
     /** Return false to cancel */
@@ -82,24 +130,72 @@ public:
 
     void setCallbackHandler(DeviceCallbacks *handler);
 
-    device_type_t getType();
+    virtual device_type_t getType();
 
-    void setEventMask(unsigned int events) throw(DeviceException);
+    virtual void setEventMask(unsigned int events) throw(DeviceException);
 
-    void setFingerprint(const void *data, unsigned int size)
+    virtual void setFingerprint(const void *data, unsigned int size)
 	throw(DeviceException);
 
-    void version(unsigned char *data, unsigned int size)
+    virtual void version(unsigned char *data, unsigned int size)
 	throw(DeviceException);
 
+    /** Read device memory, through the page cache if it's enabled */
     void read(unsigned int addr, void *data, unsigned int size)
 	throw(DeviceException);
 
+    /**
+     * Read several memory ranges with as few device reads as possible
+     *
+     * Overlapping and adjacent ranges are read together, as are
+     * ranges separated by no more than the gap set with
+     * setReadGap(). The ranges may be given in any order.
+     *
+     * @return Number of reads issued to the device, including
+     *         retries. Ranges served from the page cache don't count.
+     */
+    unsigned int readv(const std::vector<ReadRange> &ranges)
+	throw(DeviceException);
+
+    /**
+     * Read up to this many unneeded bytes between two ranges in
+     * readv() rather than starting a new read. Should be set to what
+     * the bytes transferred in one round trip cost.
+     */
+    void setReadGap(unsigned int gap) { readGap = gap; }
+
+    /** Write device memory, invalidating any cached pages */
     void write(unsigned int addr, void *data, unsigned int size)
 	throw(DeviceException);
 
+    /**
+     * Download dives, see DeviceCallbacks
+     *
+     * A download that fails is restarted from the beginning according
+     * to the retry policy, libdivecomputer can't resume a download.
+     * Dives that were passed to the callback handler before the
+     * failure are transferred again but not passed again, neither is
+     * the device info.
+     */
     void forEach() throw(DeviceException);
 
+    void setRetryPolicy(const RetryPolicy &policy) { retryPolicy = policy; }
+    const RetryPolicy &getRetryPolicy() const { return retryPolicy; }
+    /** Number of failed transfers that have been retried */
+    unsigned int getRetries() const { return retries; }
+
+    /** Throughput and latency of the transfers made so far */
+    const TransferStats &getStats() const { return stats; }
+
+    /**
+     * Cache device memory in pages of a given size, 0 disables the
+     * cache. See PageCache.
+     */
+    void setCachePageSize(unsigned int size) { cache.setPageSize(size); }
+    /** Drop cached memory, e.g. after the device has been modified */
+    void invalidateCache() { cache.clear(); }
+    const PageCache &getCache() const { return cache; }
+
 protected:
     Device(device_t *device);
     Device();
@@ -107,6 +203,32 @@ protected:
     void init() throw(DeviceException);
     void close() throw(DeviceException);
 
+    /** Read or write device memory, bypassing the cache */
+    virtual void readDevice(unsigned int addr, void *data, unsigned int size)
+	throw(DeviceException);
+    virtual void writeDevice(unsigned int addr, void *data, unsigned int size)
+	throw(DeviceException);
+
+    /** Download dives once, without retrying */
+    virtual void forEachDevice() throw(DeviceException);
+
+    /**
+     * Read in blocks of this size, so that failed blocks can be
+     * retried and long reads cancelled between blocks. 0 reads and
+     * retries whole reads. Should be set to the size the device
+     * transfers in one command.
+     */
+    void setRetryBlockSize(unsigned int size) { retryBlockSize = size; }
+
+    /*
+     * Pass events and dives to the callback handler. Used by devices
+     * that aren't backed by libdivecomputer.
+     */
+    void emitEvent(device_event_t event, const void *data);
+    bool emitCancel();
+    bool emitDive(const void *data, unsigned int size,
+		  const void *fingerprint, unsigned int fsize);
+
     device_t *device;
 
 private:
@@ -118,7 +240,64 @@ private:
 			    const unsigned char *fingerprint, unsigned int fsize,
 			    void *userdata);
 
+    /** Read through readDevice(), retrying failed blocks */
+    void readBlocks(unsigned int addr, void *data, unsigned int size)
+	throw(DeviceException);
+    /**
+     * Wait before retrying a failed transfer, false to give up. Throws
+     * DEVICE_STATUS_CANCELLED if the callback handler cancels.
+     */
+    bool retryAfter(const DeviceException &error, unsigned int attempt);
+
+    /**
+     * Pass a dive to the callback handler unless it's a duplicate. The
+     * latency is the time it took to receive the dive, it's recorded
+     * in the statistics for dives that aren't duplicates.
+     */
+    int deliverDive(const unsigned char *data, unsigned int size,
+		    const unsigned char *fingerprint, unsigned int fsize,
+		    uint64_t latency);
+
+    /** Record the transfer since the last progress event as a read */
+    void recordProgress(const device_progress_t &progress, uint64_t now);
+
+    /** Account for time spent in the callback handler */
+    uint64_t beginCallback();
+    void endCallback(uint64_t start);
+    /** Account for time spent waiting for the user */
+    void endWait();
+
     DeviceCallbacks *callbacks;
+    PageCache cache;
+    unsigned int readGap;
+    /** Number of readDevice() calls made through readBlocks() */
+    unsigned int deviceReads;
+
+    RetryPolicy retryPolicy;
+    unsigned int retryBlockSize;
+    unsigned int retries;
+
+    /** Fingerprints of the dives delivered by the current forEach() */
+    std::vector<std::vector<unsigned char> > delivered;
+    /** Number of dives seen by the current attempt */
+    unsigned int diveIndex;
+    bool retrying;
+    /** A retry produced different dives than the failed attempt */
+    bool diveMismatch;
+
+    TransferStats stats;
+    /** Time the current dive started to arrive */
+    uint64_t diveStart;
+    /** Time spent waiting or in callbacks during forEachDevice() */
+    uint64_t pausedTime;
+    /** Time of the last waiting event, 0 if the device isn't waiting */
+    uint64_t waitingSince;
+    /**
+     * Time and byte count of the last progress event of the current
+     * download, 0 if no download is running
+     */
+    uint64_t progressStart;
+    unsigned int progressBytes;
 };
 
 DCXX_END_NS
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DCXX_MEMORY_HH
+#define DCXX_MEMORY_HH
+
+#include <vector>
+#include <string>
+
+#include <dcxx/utils.hh>
+#include <dcxx/device.hh>
+
+DCXX_BEGIN_NS_DC
+
+/**
+ * Device simulated from a memory image
+ *
+ * The device serves reads, writes and dives from a memory dump, e.g.
+ * one created with "dcvyper --raw-memory", instead of talking to a
+ * real dive computer. Writes only change the in-memory copy of the
+ * image.
+ *
+ * Transfers can be slowed down to mimic a serial line and can be
+ * made to fail at random to exercise error handling.
+ */
+class MemoryDevice
+    : public Device
+{
+public:
+    struct Options {
+	Options()
+	    : latency(0), errorRate(0), error(DEVICE_STATUS_TIMEOUT),
+	      seed(1) {}
+
+	/** Time to transfer one byte, in microseconds */
+	double latency;
+	/** Probability that a transfer fails */
+	double errorRate;
+	/** Status of an injected failure */
+	device_status_t error;
+	/** Seed for the error injection */
+	unsigned int seed;
+    };
+
+    MemoryDevice(const char *image, const Options &options)
+	throw(DeviceException);
+    ~MemoryDevice() throw(DeviceException);
+
+    void setEventMask(unsigned int events) throw(DeviceException);
+
+    void setFingerprint(const void *data, unsigned int size)
+	throw(DeviceException);
+
+protected:
+    void readDevice(unsigned int addr, void *data, unsigned int size)
+	throw(DeviceException);
+
+    void writeDevice(unsigned int addr, void *data, unsigned int size)
+	throw(DeviceException);
+
+    /**
+     * Simulate the transfer of a number of bytes, throws a
+     * DeviceException if an error is injected or the transfer is
+     * cancelled
+     */
+    void transfer(unsigned int size) throw(DeviceException);
+
+    /** Emit an event if it isn't masked */
+    void event(device_event_t event, const void *data);
+
+    /**
+     * Pass a dive extracted from the image to the callback handler
+     *
+     * Handles fingerprints, progress, cancellation and injected
+     * errors. Returns false when the extraction should stop, in which
+     * case getStatus() tells why.
+     */
+    bool dive(const void *data, unsigned int size,
+	      const void *fingerprint, unsigned int fsize);
+
+    /** Start a new forEach() */
+    void beginForEach();
+    /** Status of the current forEach() */
+    device_status_t getStatus() const { return status; }
+
+    std::vector<unsigned char> image;
+
+private:
+    const Options options;
+    unsigned int seed;
+
+    unsigned int events;
+    std::vector<unsigned char> fingerprint;
+
+    device_status_t status;
+    device_progress_t progress;
+};
+
+DCXX_END_NS
+
+#endif
@@ -59,8 +59,149 @@ private:
 };
 
 class Parser;
+class DiveProfile;
 
-class ParserCallbacks {
+/**
+ * Summary of a dive, see Parser::getHeader()
+ *
+ * Every field comes with the status of reading it from the parser,
+ * fields that couldn't be read keep their default value.
+ */
+struct DiveHeader {
+    DiveHeader();
+
+    bool hasDateTime() const { return dateTimeStatus == PARSER_STATUS_SUCCESS; }
+    bool hasDiveTime() const { return diveTimeStatus == PARSER_STATUS_SUCCESS; }
+    bool hasMaxDepth() const { return maxDepthStatus == PARSER_STATUS_SUCCESS; }
+    bool hasGasMixes() const { return gasMixesStatus == PARSER_STATUS_SUCCESS; }
+
+    /** When the dive started, see Parser::getDateTime() */
+    time_t dateTime;
+    parser_status_t dateTimeStatus;
+
+    Duration diveTime;
+    parser_status_t diveTimeStatus;
+
+    Length maxDepth;
+    parser_status_t maxDepthStatus;
+
+    std::vector<gasmix_t> gasMixes;
+    parser_status_t gasMixesStatus;
+};
+
+/**
+ * Statically dispatched sample callbacks
+ *
+ * Handlers derive from SampleHandler<Handler> and hide the on*()
+ * methods they are interested in, the defaults ignore the sample
+ * field. Since the handler type is known at compile time, the
+ * dispatch from Parser::forEachSample(Handler &) to the handler's
+ * methods doesn't involve any virtual calls and can be inlined.
+ */
+template<typename Handler>
+class SampleHandler {
+public:
+    friend class Parser;
+
+    SampleHandler()
+	: inSample(false) {}
+
+    void onBeginSample() {}
+    void onEndSample() {}
+
+    void onTime(Duration time) {}
+    void onDepth(Length depth) {}
+    void onPressure(unsigned int tank, double value) {}
+    void onTemperature(Temperature temp) {}
+    void onEvent(parser_sample_event_t type, Duration time,
+		 unsigned int flags, unsigned int value) {}
+    void onRBT(unsigned int rbt) {}
+    void onHeartBeat(unsigned int heartbeat) {}
+    void onBearing(unsigned int bearing) {}
+    void onVendor(unsigned int type,
+		  unsigned int size, const void *data) {}
+
+protected:
+    void dispatchSample(parser_sample_type_t type,
+			parser_sample_value_t value);
+
+    void beginSample() {
+	inSample = true;
+	handler().onBeginSample();
+    }
+
+    void terminateSample() {
+	if (inSample) {
+	    handler().onEndSample();
+	    inSample = false;
+	}
+    }
+
+    bool inSample;
+
+private:
+    Handler &handler() { return static_cast<Handler &>(*this); }
+};
+
+template<typename Handler>
+inline void
+SampleHandler<Handler>::dispatchSample(parser_sample_type_t type,
+				       parser_sample_value_t value)
+{
+    switch (type) {
+    case SAMPLE_TYPE_TIME:
+	terminateSample();
+	beginSample();
+	handler().onTime(Duration::seconds(value.time));
+	break;
+
+    case SAMPLE_TYPE_DEPTH:
+	handler().onDepth(Length::metre(value.depth));
+	break;
+
+    case SAMPLE_TYPE_PRESSURE:
+	handler().onPressure(value.pressure.tank, value.pressure.value);
+	break;
+
+    case SAMPLE_TYPE_TEMPERATURE:
+	handler().onTemperature(Temperature::celsius(value.temperature));
+	break;
+
+    case SAMPLE_TYPE_EVENT:
+	handler().onEvent((parser_sample_event_t)value.event.type,
+			  Duration::seconds(value.event.time),
+			  value.event.flags, value.event.value);
+	break;
+
+    case SAMPLE_TYPE_RBT:
+	handler().onRBT(value.rbt);
+	break;
+
+    case SAMPLE_TYPE_HEARTBEAT:
+	handler().onHeartBeat(value.heartbeat);
+	break;
+
+    case SAMPLE_TYPE_BEARING:
+	handler().onBearing(value.bearing);
+	break;
+
+    case SAMPLE_TYPE_VENDOR:
+	handler().onVendor(value.vendor.type, value.vendor.size,
+			   value.vendor.data);
+	break;
+    }
+}
+
+/**
+ * Dynamically dispatched sample callbacks
+ *
+ * Adapter for handlers that are selected at run time, see
+ * Parser::setCallbackHandler(). Every sample field costs a virtual
+ * call, so prefer SampleHandler when the handler type is known.
+ */
+class ParserCallbacks
+    : public SampleHandler<ParserCallbacks>
+{
 public:
     friend class Parser;
 
@@ -84,12 +225,6 @@ public:
     virtual void onBearing(unsigned int bearing) {}
     virtual void onVendor(unsigned int type,
 			  unsigned int size, const void *data) {}
-
-protected:
-    void beginSample();
-    void terminateSample();
-
-    bool inSample;
 };
 
 class Parser {
@@ -104,12 +239,68 @@ public:
 
     void setData(const void *data, unsigned int size) throw(ParserException);
 
+    /** Pass all samples to the handler set by setCallbackHandler() */
     void forEachSample() throw(ParserException);
 
+    /** Pass all samples to a statically dispatched handler */
+    template<typename Handler>
+    void forEachSample(SampleHandler<Handler> &handler)
+	throw(ParserException) {
+	DCXX_PARSER_TRY(
+	    parser_samples_foreach(parser, &Parser::sampleCallback<Handler>,
+				   (void *)&handler));
+	handler.terminateSample();
+    }
+
+    /**
+     * Decode all samples of the dive into a profile in one pass. The
+     * profile is cleared first.
+     */
+    void getProfile(DiveProfile &profile) throw(ParserException);
+
+    /**
+     * @{
+     * Read a field of the dive header
+     *
+     * These return the parser status instead of throwing, which is
+     * cheaper for fields that are routinely missing, e.g. when
+     * processing dives from different types of dive computers. The
+     * value is only updated if the field could be read. The field is
+     * decoded on every call, see getHeader().
+     */
+    parser_status_t tryGetDiveTime(Duration &time) throw();
+    parser_status_t tryGetMaxDepth(Length &depth) throw();
+    parser_status_t tryGetGasMixes(GasMixVector &mixes) throw();
+    parser_status_t tryGetDateTime(time_t &time) throw();
+
+    parser_status_t tryGetField(parser_field_type_t type, unsigned int flags,
+				void *value) throw();
+
+    template<typename T>
+    parser_status_t tryGetField(parser_field_type_t type, unsigned int flags,
+				T &value) throw() {
+	T val;
+	parser_status_t status(tryGetField(type, flags, (void *)&val));
+	if (status == PARSER_STATUS_SUCCESS)
+	    value = val;
+	return status;
+    }
+    /** @} */
+
+    /**
+     * Return the header of the current dive
+     *
+     * Each field is decoded the first time it is requested after
+     * setData() and cached, later calls return the same header.
+     * getDiveTime(), getMaxDepth(), getGasMixes() and getDateTime()
+     * are served from the header and only decode their own field.
+     */
+    const DiveHeader &getHeader() throw();
+
     Duration getDiveTime() throw(ParserException);
     Length getMaxDepth() throw(ParserException);
     GasMixVector &getGasMixes(GasMixVector &mixes) throw(ParserException);
-    GasMixVector &getGasMixes() throw(ParserException) {
+    GasMixVector getGasMixes() throw(ParserException) {
 	GasMixVector mixes;
 	return getGasMixes(mixes);
     }
@@ -127,6 +318,14 @@ public:
      */
     time_t getDateTime() throw(ParserException);
 
+    template<typename T>
+    T getField(parser_field_type_t type, unsigned int flags)
+	throw(ParserException) {
+	T val;
+	DCXX_PARSER_TRY(tryGetField(type, flags, val));
+	return val;
+    }
+
 protected:
     Parser(parser_t *parser);
     Parser();
@@ -135,14 +334,6 @@ protected:
     void getField(parser_field_type_t type, unsigned int flags, void *value)
 	throw(ParserException);
 
-    template<typename T>
-    T getField(parser_field_type_t type, unsigned int flags)
-	throw(ParserException) {
-	T val;
-	getField(type, flags, &val);
-	return val;
-    }
-
     parser_t *parser;
 
 private:
@@ -150,9 +341,32 @@ private:
 			       parser_sample_value_t value,
 			       void *userdata);
 
+    template<typename Handler>
+    static void sampleCallback(parser_sample_type_t type,
+			       parser_sample_value_t value,
+			       void *userdata) {
+	static_cast<SampleHandler<Handler> *>(userdata)->
+	    dispatchSample(type, value);
+    }
+
+    /** Header fields, for tracking which have been decoded */
+    enum HeaderField {
+	HEADER_DATETIME = 0x01,
+	HEADER_DIVETIME = 0x02,
+	HEADER_MAXDEPTH = 0x04,
+	HEADER_GASMIXES = 0x08,
+	HEADER_ALL = 0x0F,
+    };
+
+    const DiveHeader &decodeHeader(unsigned int fields) throw();
+
     ParserCallbacks *callbacks;
     const void *data;
     unsigned int size;
+
+    DiveHeader header;
+    /** HeaderField flags of the fields decoded since setData() */
+    unsigned int headerDecoded;
 };
 
 DCXX_END_NS
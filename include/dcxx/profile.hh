@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DCXX_PROFILE_HH
+#define DCXX_PROFILE_HH
+
+#include <vector>
+
+#include <dcxx/utils.hh>
+#include <dcxx/types.hh>
+#include <libdivecomputer/parser.h>
+
+DCXX_BEGIN_NS_DC
+
+/**
+ * Samples of a dive stored as one array per channel
+ *
+ * Sample i is made up of element i of every channel. Channels that
+ * weren't present in a sample are marked in a validity bitmap, their
+ * values are 0. Values are stored in the base units of the dcxx types,
+ * i.e. seconds, metres and kelvin, pressures in bar. Events are kept
+ * in a separate array, the events of sample i are found between
+ * eventOffsets()[i] and eventOffsets()[i + 1].
+ *
+ * Profiles are filled by Parser::getProfile(). A profile can be
+ * reused for several dives, clear() keeps the allocated memory.
+ */
+class DiveProfile {
+public:
+    struct Event {
+	parser_sample_event_t type;
+	/** Event time in seconds, as reported by the parser */
+	unsigned int time;
+	unsigned int flags;
+	unsigned int value;
+    };
+
+    typedef std::vector<double> Channel;
+    typedef std::vector<bool> ValidMap;
+
+    /**
+     * Highest number of tanks kept, pressure samples for tanks beyond
+     * it are dropped. This bounds the memory a corrupt dive can make
+     * the profile allocate.
+     */
+    static const unsigned int MAX_TANKS = 16;
+
+    DiveProfile();
+
+    /** Drop all samples, keeping the memory allocated */
+    void clear();
+    /** Allocate memory for a number of samples */
+    void reserve(unsigned int samples);
+
+    unsigned int size() const { return times.size(); }
+    bool empty() const { return times.empty(); }
+
+    Duration getTime(unsigned int i) const { return times[i]; }
+
+    bool hasDepth(unsigned int i) const { return depthValid[i]; }
+    Length getDepth(unsigned int i) const { return depths[i]; }
+
+    bool hasTemperature(unsigned int i) const { return temperatureValid[i]; }
+    Temperature getTemperature(unsigned int i) const {
+	return temperatures[i];
+    }
+
+    /** Number of tanks with pressure samples */
+    unsigned int getTanks() const { return tanks; }
+    bool hasPressure(unsigned int tank, unsigned int i) const {
+	return pressureValid[tank][i];
+    }
+    double getPressure(unsigned int tank, unsigned int i) const {
+	return pressures[tank][i];
+    }
+
+    unsigned int getEventCount(unsigned int i) const {
+	return offsets[i + 1] - offsets[i];
+    }
+    const Event &getEvent(unsigned int i, unsigned int no) const {
+	return events[offsets[i] + no];
+    }
+
+    /** @{ */
+    /** Whole channels, for analyses running over all samples */
+    const Channel &timeChannel() const { return times; }
+    const Channel &depthChannel() const { return depths; }
+    const ValidMap &depthValidMap() const { return depthValid; }
+    const Channel &temperatureChannel() const { return temperatures; }
+    const ValidMap &temperatureValidMap() const { return temperatureValid; }
+    const Channel &pressureChannel(unsigned int tank) const {
+	return pressures[tank];
+    }
+    const ValidMap &pressureValidMap(unsigned int tank) const {
+	return pressureValid[tank];
+    }
+    const std::vector<Event> &eventList() const { return events; }
+    const std::vector<unsigned int> &eventOffsets() const { return offsets; }
+    /** @} */
+
+    /** Start a new sample, the setters below apply to the last sample */
+    void addSample(Duration time);
+    void setDepth(Length depth);
+    void setTemperature(Temperature temp);
+    void setPressure(unsigned int tank, double value);
+    void addEvent(parser_sample_event_t type, Duration time,
+		  unsigned int flags, unsigned int value);
+
+private:
+    void addTank();
+
+    unsigned int capacity;
+    /** Number of tanks in use, channels beyond it are spare */
+    unsigned int tanks;
+
+    Channel times;
+    Channel depths;
+    ValidMap depthValid;
+    Channel temperatures;
+    ValidMap temperatureValid;
+
+    std::vector<Channel> pressures;
+    std::vector<ValidMap> pressureValid;
+
+    std::vector<Event> events;
+    /** Index of the first event of every sample, followed by the end */
+    std::vector<unsigned int> offsets;
+};
+
+DCXX_END_NS
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DCXX_STATS_HH
+#define DCXX_STATS_HH
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <dcxx/utils.hh>
+
+DCXX_BEGIN_NS_DC
+
+/**
+ * Histogram of durations in microseconds
+ *
+ * Works like HdrHistogram: every power of two is split into
+ * SUB_BUCKETS linear buckets, so buckets get wider with the magnitude
+ * of the values they hold and any value is known within 1/SUB_BUCKETS
+ * of its size. Small durations and timeouts of several seconds can be
+ * recorded in the same histogram without configuration.
+ */
+class Histogram {
+public:
+    Histogram();
+
+    void record(uint64_t value);
+    void clear();
+
+    uint64_t getCount() const { return count; }
+    uint64_t getMin() const { return count ? min : 0; }
+    uint64_t getMax() const { return max; }
+    double getMean() const { return count ? (double)sum / count : 0; }
+
+    /**
+     * Return the value below which a fraction of the recorded values
+     * fall, e.g. 0.99 for the 99th percentile
+     */
+    uint64_t getPercentile(double fraction) const;
+
+    /** Buckets for dumping, values in [getLower(), getUpper()) */
+    unsigned int getBuckets() const { return counts.size(); }
+    uint64_t getBucketCount(unsigned int bucket) const {
+	return counts[bucket];
+    }
+    static uint64_t getLower(unsigned int bucket);
+    static uint64_t getUpper(unsigned int bucket);
+
+    static const unsigned int SUB_BUCKETS = 16;
+
+private:
+    static unsigned int bucketIndex(uint64_t value);
+
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+};
+
+/**
+ * Statistics of the transfers made by a Device
+ *
+ * Time spent in a download is split into time spent transferring
+ * data, time spent waiting (retry backoff and waiting for the user to
+ * start a transfer on the device) and time spent in the callback
+ * handler. Times are in microseconds.
+ *
+ * Reads are the transfers made through Device::read(). Downloads
+ * through libdivecomputer are counted from its progress events
+ * instead, every step between two events is one read.
+ */
+class TransferStats {
+public:
+    TransferStats();
+
+    void clear();
+
+    /** Current time in microseconds from a monotonic clock */
+    static uint64_t now();
+
+    void recordRead(unsigned int bytes, uint64_t time);
+    void recordDive(unsigned int bytes, uint64_t time);
+    void addTransferTime(uint64_t time) { transferTime += time; }
+    void addWaitTime(uint64_t time) { waitTime += time; }
+    void addCallbackTime(uint64_t time) { callbackTime += time; }
+
+    void setSerial(unsigned int serial) {
+	this->serial = serial; serialValid = true;
+    }
+
+    uint64_t getReads() const { return reads; }
+    uint64_t getReadBytes() const { return readBytes; }
+    uint64_t getDiveBytes() const { return diveBytes; }
+    uint64_t getTransferTime() const { return transferTime; }
+    uint64_t getWaitTime() const { return waitTime; }
+    uint64_t getCallbackTime() const { return callbackTime; }
+    /**
+     * Bytes transferred per second spent transferring, counted from
+     * the reads if there are any and from the dives otherwise
+     */
+    double getThroughput() const;
+
+    /** Time taken by each read from device memory */
+    const Histogram &getReadLatency() const { return readLatency; }
+    /** Time taken to receive each dive */
+    const Histogram &getDiveLatency() const { return diveLatency; }
+
+    bool isSerialValid() const { return serialValid; }
+    unsigned int getSerial() const { return serial; }
+
+    /** Print a human readable summary */
+    void print(std::ostream &out, const std::string &device) const;
+
+    /**
+     * Dump the statistics as CSV
+     *
+     * Every line starts with the device type and serial number (empty
+     * if unknown). Totals are followed by their name and value,
+     * histogram buckets by the name of the histogram, the bounds of
+     * the bucket and the number of values in it:
+     *
+     *   suunto-vyper,1234,read_bytes,8192
+     *   suunto-vyper,1234,read_latency_us,1216,1280,17
+     */
+    void dump(std::ostream &out, const std::string &device) const;
+
+private:
+    void dumpHistogram(std::ostream &out, const std::string &prefix,
+		       const char *name, const Histogram &histogram) const;
+
+    uint64_t reads;
+    uint64_t readBytes;
+    uint64_t dives;
+    uint64_t diveBytes;
+
+    uint64_t transferTime;
+    uint64_t waitTime;
+    uint64_t callbackTime;
+
+    Histogram readLatency;
+    Histogram diveLatency;
+
+    unsigned int serial;
+    bool serialValid;
+};
+
+DCXX_END_NS
+
+#endif
@@ -33,12 +33,14 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <stdint.h>
 
 #include <libdivecomputer/suunto.h>
 
 #include <dcxx/utils.hh>
 #include <dcxx/device.hh>
+#include <dcxx/memory.hh>
 #include <dcxx/parser.hh>
 #include <dcxx/types.hh>
 
@@ -66,6 +68,11 @@ public:
     Duration getTotalDiveTime();
     unsigned int getTotalDives();
     unsigned int getSerial();
+    /**
+     * Serial number as reported in DEVICE_EVENT_DEVINFO, which
+     * libdivecomputer decodes differently from getSerial()
+     */
+    unsigned int getDevInfoSerial();
     std::string getPersonalInfo();
 
     HardwareType getHWType();
@@ -79,9 +86,66 @@ public:
     Length getAlarmDepth();
     bool getAlarmDepthOn();
 
+    /**
+     * Address of the end-of-profile marker, the position in the
+     * profile ring buffer where the next dive will be written
+     */
+    unsigned int getProfileEnd();
+
+    /** Fields that tell whether a saved configuration is current */
+    struct InfoKey {
+	unsigned int serial;
+	unsigned int totalDives;
+	unsigned int profileEnd;
+    };
+
+    /** Read the InfoKey of the device, using a single short read */
+    InfoKey getInfoKey();
+
+    /**
+     * Answer queries from a configuration block saved by saveInfo()
+     * in an earlier session
+     *
+     * The copy is only used if its serial number, number of dives and
+     * ring buffer pointer match the device. Settings changed on the
+     * device without making a dive won't be noticed.
+     *
+     * @return true if the copy is used
+     */
+    bool restoreInfo(const void *data, unsigned int size);
+    /** Copy the configuration block for use with restoreInfo() */
+    void saveInfo(std::vector<char> &data);
+
+    /** Size of the dive computer's memory */
+    static const unsigned int MEMORY_SIZE = 0x2000;
+    /** Profile ring buffer, the rest of the memory is the header */
+    static const unsigned int PROFILE_BEGIN = 0x71;
+    static const unsigned int PROFILE_END = 0x2000;
+
     void setDelay(unsigned int delay) throw(DeviceException);
+    unsigned int getDelay() const { return delay; }
+
+    /**
+     * Find the shortest reliable delay between commands
+     *
+     * Short reads are made at decreasing delays, starting from the
+     * initial delay and backing off exponentially as long as the
+     * dive computer doesn't respond reliably. The shortest delay at
+     * which all probes succeed is found, a safety margin of 25% is
+     * added and confirmed with a longer run of probes. The resulting
+     * delay is set and returned.
+     */
+    unsigned int tuneDelay(unsigned int initial) throw(DeviceException);
+
     void readDive(dc_buffer_t *buffer, int init) throw(DeviceException);
 
+    /** Delay used by libdivecomputer unless told otherwise, in ms */
+    static const unsigned int DEFAULT_DELAY = 500;
+
+protected:
+    void writeDevice(unsigned int addr, void *data, unsigned int size)
+	throw(DeviceException);
+
 private:
     struct Info {
 	uint16_t maxDepth;
@@ -110,10 +174,41 @@ private:
 	char unknown4[7];
     } __attribute__((packed));
 
-    const Info &getInfo();
+    Info getInfo();
+
+    bool probeDelay(unsigned int delay, unsigned int probes)
+	throw(DeviceException);
+
+    unsigned int delay;
+
+    /** Configuration block from restoreInfo() */
+    Info restored;
+    bool restoredValid;
+};
+
+/**
+ * Vyper simulated from a memory dump, see MemoryDevice
+ */
+class VyperMemory
+    : public MemoryDevice
+{
+public:
+    VyperMemory(const char *image, const Options &options)
+	throw(DeviceException);
 
-    Info infoCache;
-    bool infoCacheValid;
+    device_type_t getType();
+
+    /** Returns the model, firmware version and serial number */
+    void version(unsigned char *data, unsigned int size)
+	throw(DeviceException);
+
+protected:
+    void forEachDevice() throw(DeviceException);
+
+private:
+    static int diveCallback(const unsigned char *data, unsigned int size,
+			    const unsigned char *fingerprint,
+			    unsigned int fsize, void *userdata);
 };
 
 class VyperParser
@@ -31,6 +31,8 @@
 #ifndef DEV_COMMON_HH
 #define DEV_COMMON_HH
 
+#include <map>
+
 #include <dcxx/device.hh>
 #include <dcxx/parser.hh>
 
@@ -38,6 +40,13 @@ struct DeviceInfo {
     device_type_t device;
     parser_type_t parser;
     const char *name;
+    /**
+     * The device is simulated from a memory image of the device
+     * type. The port is the name of the image, optionally followed by
+     * comma-separated options: latency=US (per byte), error-rate=P,
+     * error=timeout|protocol|io and seed=N.
+     */
+    bool image;
 };
 
 const DeviceInfo *getDeviceInfo(const char *devName);
@@ -45,9 +54,53 @@ const DeviceInfo *getDeviceInfo(const char *devName);
 device_type_t getDevType(const char *devName);
 parser_type_t getParserType(const char *devName);
 
-dcxx::Device *devCreate(device_type_t type, const char *port);
+/**
+ * Open a device
+ *
+ * @return The device, or NULL if the device type is unsupported
+ * @throw DeviceException if the device can't be opened
+ */
+dcxx::Device *devCreate(const DeviceInfo &info, const char *port);
 dcxx::Parser *parserCreate(parser_type_t type);
 
+/**
+ * Parsers kept for reuse, one per parser type
+ *
+ * Creating a parser allocates both the dcxx object and the
+ * libdivecomputer parser. Batch conversions should instead get a
+ * parser from a pool and rebind it to every dive using
+ * Parser::setData(). A pool must only be used by one thread at a time,
+ * local() returns a pool private to the calling thread.
+ */
+class ParserPool {
+public:
+    ParserPool();
+    ~ParserPool();
+
+    /**
+     * Return the pool's parser for a type, creating it on first use.
+     * The parser is owned by the pool and has no callback handler,
+     * data has to be set using setData() before it is used.
+     *
+     * @return A parser, or NULL if the type is unsupported
+     */
+    dcxx::Parser *get(parser_type_t type);
+
+    /**
+     * Return the pool of the calling thread. Pools are destroyed when
+     * their thread exits, the main thread's pool at exit().
+     */
+    static ParserPool &local();
+
+private:
+    ParserPool(const ParserPool &);
+    ParserPool &operator=(const ParserPool &);
+
+    typedef std::map<parser_type_t, dcxx::Parser *> ParserMap;
+
+    ParserMap parsers;
+};
+
 extern const DeviceInfo devDevices[];
 
 #endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DIVE_ARCHIVE_HH
+#define DIVE_ARCHIVE_HH
+
+#include <stdint.h>
+
+#include "dive_store.hh"
+
+/** Maximum size of a fingerprint stored in the archive index */
+#define ARCHIVE_FP_MAX 32
+
+/**
+ * Single file, append-only dive archive
+ *
+ * All dives are stored back to back in a data file (dives.dat). A
+ * separate index file (dives.idx) holds one fixed size record per
+ * dive with the offset and size of the dive in the data file, the
+ * dive number and the fingerprint. Since the records are of fixed
+ * size and dives are numbered consecutively, the record of any dive
+ * can be located without scanning the index.
+ *
+ * Dive data is synced to disk before its index record is written, a
+ * dive is therefore only visible once it has been completely
+ * stored. Trailing garbage left by an interrupted append is discarded
+ * the next time the archive is opened for writing.
+ */
+class ArchiveDiveStore
+    : public DiveStore
+{
+public:
+    ArchiveDiveStore(const boost::filesystem::path &dir);
+    ~ArchiveDiveStore();
+
+    int getLastDive();
+
+    void readDive(int no, std::vector<char> &data);
+    void readFingerprint(int no, std::vector<char> &fp);
+
+    int addDive(const void *data, unsigned int size,
+		const void *fp, unsigned int fsize);
+
+    static bool exists(const boost::filesystem::path &dir);
+
+private:
+    struct Entry {
+	uint64_t offset;
+	uint32_t size;
+	uint32_t number;
+	uint32_t flags;
+	uint8_t fsize;
+	uint8_t fingerprint[ARCHIVE_FP_MAX];
+    };
+
+    void open(bool write);
+    void close();
+
+    void readEntry(int no, Entry &entry);
+    void encodeEntry(const Entry &entry, uint8_t *rec);
+
+    const boost::filesystem::path dataPath;
+    const boost::filesystem::path indexPath;
+
+    int dataFd;
+    int indexFd;
+    bool writable;
+
+    IoBatch batch;
+
+    /** Number of dives in the archive */
+    unsigned int count;
+    /** Offset of the first unused byte in the data file */
+    uint64_t dataEnd;
+};
+
+#endif
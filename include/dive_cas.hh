@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DIVE_CAS_HH
+#define DIVE_CAS_HH
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dive_store.hh"
+
+/**
+ * Content addressed, deduplicating dive store
+ *
+ * Raw dives are stored in a shared object directory, named by the
+ * SHA-256 of their contents. Several logbooks, e.g. one per device in
+ * a fleet, can share the same object directory. Each logbook has a
+ * manifest listing the object and fingerprint of every dive in dive
+ * number order. Objects stored by a logbook that compresses dives get
+ * the extension DIVE_COMPRESSED_EXT.
+ *
+ * The object directory keeps a list of all objects it contains. The
+ * list is loaded into memory when the first dive is stored, which
+ * means that duplicate dives are detected without touching the
+ * object directory.
+ *
+ * A DiveSpool stores the objects as the dives arrive. Objects that
+ * end up unused because a download failed are picked up again by
+ * the next session. storeData() only touches the object list, so the
+ * spool writer thread can call it while the manifest is read by the
+ * thread running the download.
+ */
+class CasDiveStore
+    : public DiveStore
+{
+public:
+    CasDiveStore(const boost::filesystem::path &dir,
+		 const boost::filesystem::path &objectDir);
+
+    int getLastDive();
+
+    void readDive(int no, std::vector<char> &data);
+    void readFingerprint(int no, std::vector<char> &fp);
+
+    int addDive(const void *data, unsigned int size,
+		const void *fp, unsigned int fsize);
+
+    /** Store a dive object, the reference is its hash */
+    std::string storeData(const void *data, unsigned int size);
+    int addDiveRef(const std::string &ref, const void *fp, unsigned int fsize);
+
+    /** Number of stored dives that were already in the object store */
+    unsigned int getDeduplicated() const { return deduplicated; }
+
+private:
+    struct Entry {
+	std::string hash;
+	std::vector<char> fingerprint;
+    };
+
+    void loadManifest();
+    void loadObjects();
+
+    boost::filesystem::path objectPath(const std::string &hash,
+				       bool compressed = false) const;
+
+    const boost::filesystem::path manifestPath;
+    const boost::filesystem::path objectDir;
+    const boost::filesystem::path objectListPath;
+
+    bool manifestLoaded;
+    /** Size of the part of the manifest that contains complete lines */
+    unsigned int manifestSize;
+    std::vector<Entry> manifest;
+
+    bool objectsLoaded;
+    std::set<std::string> objects;
+
+    unsigned int deduplicated;
+};
+
+#endif
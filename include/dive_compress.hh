@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DIVE_COMPRESS_HH
+#define DIVE_COMPRESS_HH
+
+#include <vector>
+
+/**
+ * File name extension of compressed dives
+ *
+ * Whether a dive is compressed is never guessed from its contents,
+ * since raw dive data can start with any bytes. Stores that compress
+ * dives say so in their configuration or index, compressed dives
+ * stored as separate files use this extension.
+ */
+#define DIVE_COMPRESSED_EXT ".dtz"
+
+/**
+ * Compress a single dive
+ *
+ * Every dive is compressed on its own so that it can be decoded
+ * without touching any other dive. The compressed dive starts with a
+ * small header holding the size of the raw dive.
+ *
+ * @throw DiveStoreException if compression isn't supported by this
+ *        build.
+ */
+void compressDive(const void *data, unsigned int size,
+		  std::vector<char> &out);
+
+/**
+ * Decompress a dive compressed by compressDive()
+ *
+ * @throw DiveStoreException if the data is corrupt or if compression
+ *        isn't supported by this build.
+ */
+void decompressDive(const void *data, unsigned int size,
+		    std::vector<char> &out);
+
+/** Decompress a dive compressed by compressDive() in place */
+void decompressDive(std::vector<char> &data);
+
+/** True if this build supports compressed dives */
+bool haveDiveCompression();
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef DIVE_SCRUB_HH
+#define DIVE_SCRUB_HH
+
+#include <vector>
+#include <stdint.h>
+
+#include <boost/filesystem.hpp>
+
+class DirDiveStore;
+
+/** Checksums of a stored dive and its fingerprint */
+struct DiveChecksum {
+    DiveChecksum()
+	: valid(false), dive(0), fingerprint(0) {}
+
+    bool valid;
+    uint32_t dive;
+    uint32_t fingerprint;
+};
+
+/**
+ * CRC-32C checksums of the files in a DirDiveStore
+ *
+ * The checksums are kept in an append-only file with one line per
+ * dive. The last line for a dive overrides any earlier ones and
+ * malformed lines, e.g. a line that was only partially written
+ * before a crash, are ignored.
+ */
+class DiveChecksums {
+public:
+    DiveChecksums(const boost::filesystem::path &path);
+
+    /** Checksum of a dive, not valid if none has been recorded */
+    DiveChecksum get(int no);
+    void add(int no, uint32_t dive, uint32_t fingerprint);
+
+    /** Number of dives with a recorded checksum */
+    unsigned int size();
+
+private:
+    void load();
+
+    const boost::filesystem::path path;
+    bool loaded;
+    std::vector<DiveChecksum> sums;
+};
+
+/** Outcome of a scrub */
+struct ScrubResult {
+    ScrubResult()
+	: checked(0), unchecked(0), updated(0), bytes(0) {}
+
+    /** Dives with a matching checksum */
+    unsigned int checked;
+    /** Dives without a recorded checksum */
+    unsigned int unchecked;
+    /** Dives that got a checksum recorded by the scrub */
+    unsigned int updated;
+    /** Dives with a file that is missing */
+    std::vector<int> missing;
+    /** Dives with a file that exists but can't be read */
+    std::vector<int> unreadable;
+    /** Dives with a file that doesn't match its checksum */
+    std::vector<int> corrupt;
+
+    uint64_t bytes;
+};
+
+/**
+ * Verify all dives in a store against their checksums
+ *
+ * The dives are divided between several threads. Dives without a
+ * checksum are only checked for existence, unless update is set, in
+ * which case their checksums are recorded.
+ */
+void scrubDirStore(DirDiveStore &store, unsigned int threads, bool update,
+		   ScrubResult &result);
+
+#endif
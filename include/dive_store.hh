@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DIVE_STORE_HH
+#define DIVE_STORE_HH
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "batch_io.hh"
+#include "dive_scrub.hh"
+
+class DCConf;
+
+class DiveStoreException {
+public:
+    DiveStoreException(const std::string &msg);
+
+    const char *what() const throw();
+
+private:
+    std::string msg;
+};
+
+/**
+ * Write a file atomically
+ *
+ * The data is written to a temporary file in the same directory,
+ * synced to disk and then renamed to its final name. A reader will
+ * therefore either see the old file or the complete new file, never
+ * a partially written one.
+ */
+void writeFileAtomic(const boost::filesystem::path &path,
+		     const void *data, unsigned int size);
+
+/** A file to write using writeFilesAtomic() */
+struct AtomicFile {
+    AtomicFile(const boost::filesystem::path &_path,
+	       const void *_data, unsigned int _size)
+	: path(_path), data(_data), size(_size) {}
+
+    boost::filesystem::path path;
+    const void *data;
+    unsigned int size;
+};
+
+/**
+ * Write several files atomically
+ *
+ * All files are written and synced as one I/O batch. The files are
+ * then renamed in the order they are listed, so a file is never
+ * visible before the files preceding it.
+ */
+void writeFilesAtomic(IoBatch &batch,
+		      const AtomicFile *files, unsigned int count);
+
+void readFile(const boost::filesystem::path &path, std::vector<char> &data);
+
+/**
+ * Read-only view of a file's contents
+ *
+ * Regular files are mapped into memory so that their contents can be
+ * handed to a parser without being copied. Files that can't be
+ * mapped, such as pipes, are read into a private buffer instead.
+ */
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    /** Open a file, replacing any previously opened file */
+    void open(const boost::filesystem::path &path);
+    /** Read from an already open descriptor, e.g. standard input */
+    void open(int fd, const std::string &name);
+    void close();
+
+    const char *data() const { return base; }
+    unsigned int size() const { return length; }
+
+    bool isMapped() const { return map != NULL; }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    void readAll(int fd, const std::string &name);
+
+    void *map;
+    size_t mapSize;
+    std::vector<char> buffer;
+
+    const char *base;
+    unsigned int length;
+};
+
+std::string toHex(const std::vector<char> &data);
+bool fromHex(const std::string &hex, std::vector<char> &data);
+
+/**
+ * Persistent storage of downloaded dives
+ *
+ * Dives are numbered from 0 in the order they were made, i.e. the
+ * oldest dive on the dive computer gets the lowest number.
+ */
+class DiveStore {
+public:
+    virtual ~DiveStore();
+
+    /**
+     * Compress dives that are added to the store and decompress them
+     * when read. This is part of the store's configuration, stores
+     * don't mix compressed and raw dives.
+     */
+    void setCompression(bool enable) { compress = enable; }
+
+    /** Return the number of the newest stored dive, or -1 if empty */
+    virtual int getLastDive() = 0;
+
+    virtual void readDive(int no, std::vector<char> &data) = 0;
+    virtual void readFingerprint(int no, std::vector<char> &fp) = 0;
+
+    /** Store a dive, dives must be added oldest first */
+    virtual int addDive(const void *data, unsigned int size,
+			const void *fp, unsigned int fsize) = 0;
+
+    /**
+     * Store a dive that has already been written to disk. The source
+     * files are removed once the dive has been stored.
+     *
+     * @param sum Checksums of the source files, if known
+     */
+    virtual int moveDive(const boost::filesystem::path &data,
+			 const boost::filesystem::path &fp,
+			 const DiveChecksum &sum);
+
+    /**
+     * Store the data of a dive ahead of the dive itself, for stores
+     * that share dive data between logbooks. The data isn't part of
+     * the logbook until addDiveRef() is called with the returned
+     * reference. Stores without shared data return an empty string.
+     */
+    virtual std::string storeData(const void *data, unsigned int size);
+
+    /** Store a dive whose data was stored with storeData() */
+    virtual int addDiveRef(const std::string &ref,
+			   const void *fp, unsigned int fsize);
+
+    /**
+     * Rebuild any index the store keeps from the stored dives. Stores
+     * without a separate index don't need to do anything.
+     */
+    virtual void rebuildIndex() {}
+
+protected:
+    DiveStore();
+
+    bool compress;
+};
+
+/**
+ * Legacy storage format with one dive_N.raw and one dive_N.fp file
+ * per dive in the output directory. Compressed dives are stored as
+ * dive_N.dtz instead.
+ *
+ * The number and fingerprint of the newest dive are kept in
+ * .divetools/index, which is updated atomically whenever a dive is
+ * stored. Checksums of the stored files are appended to
+ * .divetools/checksums. This avoids scanning the output directory when a session
+ * starts. The index is created from a directory scan if it is missing
+ * and can be rebuilt using rebuildIndex() if it has gone stale.
+ */
+class DirDiveStore
+    : public DiveStore
+{
+public:
+    DirDiveStore(const boost::filesystem::path &dir);
+
+    int getLastDive();
+
+    void readDive(int no, std::vector<char> &data);
+    void readFingerprint(int no, std::vector<char> &fp);
+
+    int addDive(const void *data, unsigned int size,
+		const void *fp, unsigned int fsize);
+
+    int moveDive(const boost::filesystem::path &data,
+		 const boost::filesystem::path &fp,
+		 const DiveChecksum &sum);
+
+    void rebuildIndex();
+
+    /**
+     * Return the number of the newest dive according to the index or
+     * the dive files, whichever is higher. Unlike getLastDive(), the
+     * dive isn't required to exist, which lets a scrub report it as
+     * missing.
+     */
+    int findNewestDive();
+
+    boost::filesystem::path divePath(int no) const;
+    boost::filesystem::path fingerprintPath(int no) const;
+
+    /** CRC-32C checksums of the stored files, see scrubDirStore() */
+    DiveChecksums &getChecksums() { return checksums; }
+
+private:
+    int findLastDive();
+
+    bool readIndex(int &last, std::vector<char> &fp);
+    void loadIndex();
+    void saveIndex();
+    std::string formatIndex() const;
+
+    const boost::filesystem::path dir;
+    const boost::filesystem::path indexPath;
+    int lastDive;
+    bool lastDiveValid;
+    /** Fingerprint of the newest dive */
+    std::vector<char> lastFp;
+
+    DiveChecksums checksums;
+
+    IoBatch batch;
+};
+
+/**
+ * Staging area for dives that are being downloaded
+ *
+ * Dive computers report dives newest first, which means that a dive
+ * can't be given its final number until the whole download has
+ * completed. The spool writes every dive to disk as soon as it
+ * arrives so that only one dive at a time has to be kept in
+ * memory. Once the download is complete, the spooled dives are
+ * committed to a DiveStore in chronological order.
+ *
+ * A spool left behind by an interrupted download is picked up by the
+ * next session. Dives that are downloaded again and match the
+ * spooled fingerprint aren't rewritten.
+ *
+ * The checksums of each spooled dive are computed while the data is
+ * at hand and kept next to it, so that the store can record them
+ * without reading the dive back.
+ *
+ * Stores that share dive data get it as soon as a dive arrives, see
+ * DiveStore::storeData(). Only the returned reference is spooled, so
+ * dives that are already in the store aren't written again.
+ */
+class DiveSpool {
+public:
+    DiveSpool(const boost::filesystem::path &dir, DiveStore &store);
+
+    /** Number of dives in the spool */
+    unsigned int size() const { return count; }
+
+    /** Spool the next dive in download order */
+    void addDive(const void *data, unsigned int size,
+		 const void *fp, unsigned int fsize);
+
+    /** Move all spooled dives to the store, oldest first */
+    void commit();
+
+    /** Number of dives that were reused from an earlier session */
+    unsigned int getReused() const { return reused; }
+
+private:
+    void open();
+
+    boost::filesystem::path divePath(unsigned int no) const;
+    boost::filesystem::path fingerprintPath(unsigned int no) const;
+    boost::filesystem::path checksumPath(unsigned int no) const;
+    boost::filesystem::path refPath(unsigned int no) const;
+
+    void truncate(unsigned int no);
+
+    const boost::filesystem::path dir;
+    DiveStore &store;
+    bool isOpen;
+
+    /** Number of valid dives in the spool */
+    unsigned int count;
+    /** Position in the current download */
+    unsigned int pos;
+    unsigned int reused;
+
+    IoBatch batch;
+};
+
+/**
+ * Create a dive store
+ *
+ * @param conf Configuration selecting the storage format ("dir",
+ *             "archive" or "cas") and its options
+ * @param dir Directory containing the dives
+ * @return A new store, or NULL if the format is unknown
+ */
+DiveStore *storeCreate(const DCConf &conf,
+		       const boost::filesystem::path &dir);
+
+#endif
@@ -34,7 +34,7 @@
 #include "serialize/sample.hh"
 
 class SerializeCSV
-    : public SampleBuilder
+    : public SampleBuilder<SerializeCSV>
 {
 public:
     SerializeCSV(std::ostream &out);
@@ -44,21 +44,34 @@ struct Sample {
     ValidValue<dcxx::Temperature> temperature;
 };
 
+/**
+ * Collect the fields of a sample and pass the complete sample to
+ * Builder::onSample(const Sample &).
+ */
+template<typename Builder>
 class SampleBuilder
-    : public dcxx::ParserCallbacks
+    : public dcxx::SampleHandler<Builder>
 {
 public:
-    SampleBuilder();
-    virtual ~SampleBuilder();
+    void onBeginSample() {
+	sample = Sample();
+    }
+
+    void onEndSample() {
+	static_cast<Builder *>(this)->onSample(sample);
+    }
 
-    virtual void onSample(const Sample &sample) = 0;
+    void onTime(dcxx::Duration time) {
+	sample.time = time;
+    }
 
+    void onDepth(dcxx::Length depth) {
+	sample.depth = depth;
+    }
 
-    void onBeginSample();
-    void onEndSample();
-    void onTime(dcxx::Duration time);
-    void onDepth(dcxx::Length depth);
-    void onTemperature(dcxx::Temperature temp);
+    void onTemperature(dcxx::Temperature temp) {
+	sample.temperature = temp;
+    }
 
 private:
     Sample sample;
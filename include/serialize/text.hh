@@ -34,7 +34,7 @@
 #include "dcxx/parser.hh"
 
 class SerializeText
-    : public dcxx::ParserCallbacks
+    : public dcxx::SampleHandler<SerializeText>
 {
 public:
     SerializeText(std::ostream &out);
@@ -43,7 +43,7 @@ namespace uddf {
 };
 
 class SerializeUDDF
-    : public SampleBuilder
+    : public SampleBuilder<SerializeUDDF>
 {
 public:
     SerializeUDDF(std::ostream &out, dcxx::Parser &parser);
@@ -54,8 +54,8 @@ public:
 		 unsigned int flags, unsigned int value);
 
 private:
-    std::string repetitionGroupID(dcxx::Parser &parser);
-    std::string diveID(dcxx::Parser &parser);
+    std::string repetitionGroupID(time_t dateTime);
+    std::string diveID(time_t dateTime);
 
     std::ostream &out;
 
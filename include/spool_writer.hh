@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SPOOL_WRITER_HH
+#define SPOOL_WRITER_HH
+
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+
+#include "dive_store.hh"
+#include "spsc_ring.hh"
+
+/**
+ * Write dives to a spool from a separate thread
+ *
+ * Dives are copied into a bounded ring buffer and written to the
+ * spool by a writer thread. The thread receiving dives from the
+ * device therefore never waits for the file system unless the
+ * writer has fallen so far behind that the ring is full.
+ *
+ * Neither side polls. A thread that finds the ring empty or full
+ * sleeps on a condition variable that is signalled whenever a dive
+ * is queued or written and when the writer stops.
+ */
+class SpoolWriter {
+public:
+    SpoolWriter(DiveSpool &spool, unsigned int capacity = 16);
+    /** Stops the writer thread, errors are ignored */
+    ~SpoolWriter();
+
+    /**
+     * Queue a dive for the spool
+     *
+     * Waits for a free slot if the ring is full. Throws a
+     * DiveStoreException if the writer thread has failed.
+     */
+    void addDive(const void *data, unsigned int size,
+		 const void *fp, unsigned int fsize);
+
+    /**
+     * Wait for all queued dives to be written and stop the writer
+     * thread. Throws a DiveStoreException if a dive couldn't be
+     * written.
+     */
+    void finish();
+
+    /** Number of dives that had to wait for a free slot */
+    unsigned int getRingFull() const { return ringFull; }
+
+private:
+    struct Item {
+	std::vector<char> data;
+	std::vector<char> fp;
+    };
+
+    static void *threadMain(void *arg);
+    void run();
+    void stop();
+    /** Wake up the other side after changing the ring or the state */
+    void wake();
+
+    DiveSpool &spool;
+    SpscRing<Item> ring;
+
+    pthread_t thread;
+    bool running;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    /** Set by the producer once all dives have been queued */
+    volatile bool done;
+    /** Set by the writer thread if a dive couldn't be written */
+    volatile bool failed;
+    std::string error;
+
+    unsigned int ringFull;
+};
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef SPSC_RING_HH
+#define SPSC_RING_HH
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * Bounded single producer, single consumer ring buffer
+ *
+ * The producer and the consumer may run on different threads without
+ * any locking. Slots are reused, so elements that own memory (e.g.,
+ * vectors) keep their allocations between uses.
+ *
+ * The producer fills the slot returned by back() and publishes it
+ * using push(). The consumer processes the slot returned by front()
+ * and releases it using pop().
+ */
+template <typename T>
+class SpscRing
+{
+public:
+    SpscRing(unsigned int capacity)
+	: slots(capacity + 1), head(0), tail(0) {}
+
+    /** Next free slot, or NULL if the ring is full */
+    T *back() {
+	const unsigned int next(advance(tail));
+	if (next == head)
+	    return NULL;
+
+	return &slots[tail];
+    }
+
+    /** Make the slot returned by back() visible to the consumer */
+    void push() {
+	// Publish the contents of the slot before the new tail
+	__sync_synchronize();
+	tail = advance(tail);
+    }
+
+    /** Oldest published slot, or NULL if the ring is empty */
+    T *front() {
+	if (head == tail)
+	    return NULL;
+
+	// Don't read the slot before the tail that published it
+	__sync_synchronize();
+	return &slots[head];
+    }
+
+    /** Hand the slot returned by front() back to the producer */
+    void pop() {
+	// Finish using the slot before it can be reused
+	__sync_synchronize();
+	head = advance(head);
+    }
+
+private:
+    unsigned int advance(unsigned int pos) const {
+	return pos + 1 == slots.size() ? 0 : pos + 1;
+    }
+
+    std::vector<T> slots;
+
+    /** Written by the consumer only */
+    volatile unsigned int head;
+    /** Keep head and tail in different cache lines */
+    char pad[64];
+    /** Written by the producer only */
+    volatile unsigned int tail;
+};
+
+#endif
@@ -67,10 +67,12 @@ public:
 
 	value = rhs.value;
 	valid = rhs.valid;
+	return *this;
     }
 
     ValidValue<T> &operator=(const T &rhs) {
 	set(rhs);
+	return *this;
     }
 
     bool operator==(const ValidValue<T> &rhs) const {
@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "batch_io.hh"
+#include "dive_store.hh"
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <stdint.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+using namespace std;
+
+/** Maximum number of operations handed to the kernel at once */
+#define IOBATCH_ENTRIES 64
+
+static volatile unsigned long ioOperations = 0;
+static volatile unsigned long ioSyscalls = 0;
+
+static void
+throwError(const string &what, const string &name, int err)
+{
+    stringstream ss;
+    ss << what << " '" << name << "': " << strerror(err);
+    throw DiveStoreException(ss.str());
+}
+
+IoBatch::IoBatch()
+    : ops(), uring(NULL), uringFailed(false)
+{
+}
+
+IoBatch::~IoBatch()
+{
+#ifdef HAVE_LIBURING
+    if (uring) {
+	io_uring_queue_exit(uring);
+	delete uring;
+    }
+#endif
+}
+
+void
+IoBatch::write(int fd, const void *data, unsigned int size, off_t offset,
+	       const string &name)
+{
+    Op op;
+
+    op.type = OP_WRITE;
+    op.fd = fd;
+    op.data = (const char *)data;
+    op.size = size;
+    op.offset = offset;
+    op.name = name;
+
+    ops.push_back(op);
+}
+
+void
+IoBatch::sync(int fd, bool dataOnly, const string &name)
+{
+    Op op;
+
+    op.type = dataOnly ? OP_DATASYNC : OP_SYNC;
+    op.fd = fd;
+    op.data = NULL;
+    op.size = 0;
+    op.offset = 0;
+    op.name = name;
+
+    ops.push_back(op);
+}
+
+void
+IoBatch::submit()
+{
+    unsigned int done = 0;
+
+    __sync_fetch_and_add(&ioOperations, ops.size());
+
+    try {
+#ifdef HAVE_LIBURING
+	// A single operation can't be batched, don't bother setting
+	// up io_uring for it.
+	if (!uring && !uringFailed && ops.size() > 1) {
+	    uring = new struct io_uring;
+	    __sync_fetch_and_add(&ioSyscalls, 1);
+	    if (io_uring_queue_init(IOBATCH_ENTRIES, uring, 0) < 0) {
+		delete uring;
+		uring = NULL;
+		uringFailed = true;
+	    }
+	}
+
+	// Anything that io_uring didn't complete, e.g. due to a short
+	// write, is finished using POSIX calls.
+	while (uring && done < ops.size() && submitUring(done))
+	    ;
+#endif
+
+	for (; done < ops.size(); done++)
+	    performPosix(ops[done]);
+    } catch (...) {
+	ops.clear();
+	throw;
+    }
+
+    ops.clear();
+}
+
+void
+IoBatch::performPosix(Op &op)
+{
+    int ret;
+
+    switch (op.type) {
+    case OP_WRITE:
+	while (op.size > 0) {
+	    __sync_fetch_and_add(&ioSyscalls, 1);
+	    ssize_t len = op.offset == -1 ?
+		::write(op.fd, op.data, op.size) :
+		pwrite(op.fd, op.data, op.size, op.offset);
+	    if (len == -1) {
+		if (errno == EINTR)
+		    continue;
+		throwError("Failed to write", op.name, errno);
+	    }
+
+	    op.data += len;
+	    op.size -= len;
+	    if (op.offset != -1)
+		op.offset += len;
+	}
+	break;
+
+    case OP_SYNC:
+    case OP_DATASYNC:
+	__sync_fetch_and_add(&ioSyscalls, 1);
+	ret = op.type == OP_SYNC ? fsync(op.fd) : fdatasync(op.fd);
+	if (ret == -1)
+	    throwError("Failed to sync", op.name, errno);
+	break;
+    }
+}
+
+/**
+ * Submit the operations starting at first as one linked chain
+ *
+ * @param first Index of the first operation, updated to the first
+ *              operation that wasn't completed
+ * @return false if the chain stopped before its end
+ */
+bool
+IoBatch::submitUring(unsigned int &first)
+{
+#ifdef HAVE_LIBURING
+    const unsigned int count(min<size_t>(ops.size() - first,
+					  IOBATCH_ENTRIES));
+    vector<int> results(count);
+
+    for (unsigned int i = 0; i < count; i++) {
+	struct io_uring_sqe *sqe(io_uring_get_sqe(uring));
+	const Op &op(ops[first + i]);
+
+	switch (op.type) {
+	case OP_WRITE:
+	    io_uring_prep_write(sqe, op.fd, op.data, op.size, op.offset);
+	    break;
+
+	case OP_SYNC:
+	case OP_DATASYNC:
+	    io_uring_prep_fsync(sqe, op.fd,
+				op.type == OP_DATASYNC ?
+				IORING_FSYNC_DATASYNC : 0);
+	    break;
+	}
+
+	// Linking the requests makes the kernel perform them in
+	// order. A request that fails or a short write cancels the
+	// rest of the chain.
+	if (i + 1 < count)
+	    sqe->flags |= IOSQE_IO_LINK;
+	io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+    }
+
+    __sync_fetch_and_add(&ioSyscalls, 1);
+    const int ret(io_uring_submit_and_wait(uring, count));
+    if (ret < 0)
+	throwError("Failed to submit I/O for", ops[first].name, -ret);
+
+    for (unsigned int i = 0; i < count; i++) {
+	struct io_uring_cqe *cqe;
+
+	const int ret(io_uring_wait_cqe(uring, &cqe));
+	if (ret < 0)
+	    throwError("Failed to complete I/O for", ops[first].name, -ret);
+
+	results[(uintptr_t)io_uring_cqe_get_data(cqe)] = cqe->res;
+	io_uring_cqe_seen(uring, cqe);
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+	Op &op(ops[first + i]);
+	const int res(results[i]);
+
+	// Cancelled and interrupted requests are retried by the
+	// caller.
+	if (res == -ECANCELED || res == -EINTR || res == -EAGAIN) {
+	    first += i;
+	    return false;
+	}
+	else if (res < 0)
+	    throwError(op.type == OP_WRITE ?
+		       "Failed to write" : "Failed to sync",
+		       op.name, -res);
+
+	if (op.type == OP_WRITE && (unsigned int)res < op.size) {
+	    op.data += res;
+	    op.size -= res;
+	    if (op.offset != -1)
+		op.offset += res;
+
+	    first += i;
+	    return false;
+	}
+    }
+
+    first += count;
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+BatchOutputBuf::BatchOutputBuf(int _fd, const string &_name,
+			       unsigned int _chunkSize,
+			       unsigned int _batchChunks)
+    : fd(_fd), name(_name),
+      chunkSize(_chunkSize), batchChunks(_batchChunks),
+      batch(), error(), chunks(1, vector<char>(_chunkSize)), used(1)
+{
+    setp(&chunks[0][0], &chunks[0][0] + chunkSize);
+}
+
+BatchOutputBuf::~BatchOutputBuf()
+{
+    try {
+	flush();
+    } catch (DiveStoreException e) {
+    }
+}
+
+void
+BatchOutputBuf::flush()
+{
+    if (!error.empty())
+	throw DiveStoreException(error);
+
+    // All chunks but the last one are full
+    for (unsigned int i = 0; i + 1 < used; i++)
+	batch.write(fd, &chunks[i][0], chunkSize, -1, name);
+    if (pptr() != pbase())
+	batch.write(fd, pbase(), pptr() - pbase(), -1, name);
+
+    try {
+	batch.submit();
+    } catch (DiveStoreException e) {
+	error = e.what();
+	throw;
+    }
+
+    used = 1;
+    setp(&chunks[0][0], &chunks[0][0] + chunkSize);
+}
+
+BatchOutputBuf::int_type
+BatchOutputBuf::overflow(int_type c)
+{
+    // Errors are reported by flush(), streams expect EOF here
+    try {
+	nextChunk();
+    } catch (DiveStoreException e) {
+	return traits_type::eof();
+    }
+
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+int
+BatchOutputBuf::sync()
+{
+    // Stream flushes, e.g. from every std::endl, would otherwise
+    // write each line on its own. Output is written when the batch
+    // is full and by an explicit flush().
+    return error.empty() ? 0 : -1;
+}
+
+void
+BatchOutputBuf::nextChunk()
+{
+    if (used == batchChunks) {
+	flush();
+	return;
+    }
+
+    if (chunks.size() == used)
+	chunks.push_back(vector<char>(chunkSize));
+
+    char *chunk(&chunks[used++][0]);
+    setp(chunk, chunk + chunkSize);
+}
+
+
+unsigned long
+batchIoOperations()
+{
+    return ioOperations;
+}
+
+unsigned long
+batchIoSyscalls()
+{
+    return ioSyscalls;
+}
+
+unsigned long
+batchIoSaved()
+{
+    const unsigned long operations(ioOperations);
+    const unsigned long syscalls(ioSyscalls);
+
+    return operations > syscalls ? operations - syscalls : 0;
+}
+
+bool
+haveIoUring()
+{
+#ifdef HAVE_LIBURING
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "crc32c.hh"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC32C_X86 1
+#endif
+
+/* Reversed Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78
+
+/** Tables for processing eight bytes at a time */
+static uint32_t table[8][256];
+static bool tableReady = false;
+
+static void
+initTable()
+{
+    for (unsigned int i = 0; i < 256; i++) {
+	uint32_t crc = i;
+	for (int j = 0; j < 8; j++)
+	    crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+	table[0][i] = crc;
+    }
+
+    for (unsigned int i = 0; i < 256; i++)
+	for (int t = 1; t < 8; t++)
+	    table[t][i] = (table[t - 1][i] >> 8) ^
+		table[0][table[t - 1][i] & 0xff];
+
+    // Several threads may initialize the table at the same time,
+    // they all write the same values.
+    __sync_synchronize();
+    tableReady = true;
+}
+
+static uint32_t
+crc32cSoftware(uint32_t crc, const uint8_t *p, size_t size)
+{
+    if (!tableReady)
+	initTable();
+
+    while (size && ((uintptr_t)p & 7)) {
+	crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	size--;
+    }
+
+    while (size >= 8) {
+	uint32_t lo, hi;
+	memcpy(&lo, p, 4);
+	memcpy(&hi, p + 4, 4);
+#ifdef WORDS_BIGENDIAN
+	lo = __builtin_bswap32(lo);
+	hi = __builtin_bswap32(hi);
+#endif
+	lo ^= crc;
+	crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+	    table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+	    table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^
+	    table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+	p += 8;
+	size -= 8;
+    }
+
+    while (size--)
+	crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32cHardware(uint32_t crc, const uint8_t *p, size_t size)
+{
+    while (size && ((uintptr_t)p & 7)) {
+	crc = __builtin_ia32_crc32qi(crc, *p++);
+	size--;
+    }
+
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	crc64 = __builtin_ia32_crc32di(crc64, v);
+	p += 8;
+	size -= 8;
+    }
+    crc = crc64;
+#endif
+
+    while (size >= 4) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	crc = __builtin_ia32_crc32si(crc, v);
+	p += 4;
+	size -= 4;
+    }
+
+    while (size--)
+	crc = __builtin_ia32_crc32qi(crc, *p++);
+
+    return crc;
+}
+#endif
+
+bool
+haveHardwareCrc32c()
+{
+#ifdef CRC32C_X86
+    static const bool supported(__builtin_cpu_supports("sse4.2"));
+    return supported;
+#else
+    return false;
+#endif
+}
+
+uint32_t
+crc32c(uint32_t crc, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    crc = ~crc;
+#ifdef CRC32C_X86
+    if (haveHardwareCrc32c())
+	return ~crc32cHardware(crc, p, size);
+#endif
+    return ~crc32cSoftware(crc, p, size);
+}
@@ -41,7 +41,9 @@ using namespace std;
 
 DCConf::DCConf()
     : optsCommon(), cfgCommon(),
-      devPort(), devInfo(NULL), devSerial(0), devSerialValid(false)
+      devPort(), devInfo(NULL), devSerial(0), devSerialValid(false),
+      devDelay(0), devDelaySerial(0), devDelayValid(false),
+      storeFormat("dir"), storeCompress(false)
 {
     po::options_description optsDevice("Device");
     optsDevice.add_options()
@@ -61,6 +63,21 @@ DCConf::DCConf()
 	("device.serial", po::value<unsigned int>())
 	;
     cfgCommon.add(cfgDev);
+
+    po::options_description cfgStorage("storage");
+    cfgStorage.add_options()
+	("storage.format", po::value<string>())
+	("storage.objects", po::value<string>())
+	("storage.compress", po::value<bool>())
+	;
+    cfgCommon.add(cfgStorage);
+
+    po::options_description cfgTuning("tuning");
+    cfgTuning.add_options()
+	("tuning.serial", po::value<unsigned int>())
+	("tuning.delay", po::value<unsigned int>())
+	;
+    cfgCommon.add(cfgTuning);
 }
 
 DCConf::~DCConf()
@@ -86,6 +103,19 @@ DCConf::handleConf(po::variables_map vm)
 
     if (!devSerialValid && vm.count("device.serial"))
 	setDevSerial(vm["device.serial"].as<unsigned int>());
+
+    if (vm.count("storage.format"))
+	storeFormat = vm["storage.format"].as<string>();
+
+    if (vm.count("storage.objects"))
+	storeObjects = vm["storage.objects"].as<string>();
+
+    if (vm.count("storage.compress"))
+	storeCompress = vm["storage.compress"].as<bool>();
+
+    if (vm.count("tuning.serial") && vm.count("tuning.delay"))
+	setDevDelay(vm["tuning.serial"].as<unsigned int>(),
+		    vm["tuning.delay"].as<unsigned int>());
 }
 
 void
@@ -111,5 +141,21 @@ operator<<(ostream &out, const DCConf &conf)
     out << "[device]" << endl
 	<< "type = " << conf.devInfo->name << endl
 	<< "port = " << conf.devPort << endl
-	<< "serial = " << conf.devSerial;
+	<< "serial = " << conf.devSerial << endl
+	<< endl
+	<< "[storage]" << endl
+	<< "format = " << conf.storeFormat;
+
+    if (!conf.storeObjects.empty())
+	out << endl << "objects = " << conf.storeObjects;
+
+    out << endl << "compress = " << (conf.storeCompress ? "true" : "false");
+
+    if (conf.devDelayValid)
+	out << endl << endl
+	    << "[tuning]" << endl
+	    << "serial = " << conf.devDelaySerial << endl
+	    << "delay = " << conf.devDelay;
+
+    return out;
 }
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <dcxx/utils.hh>
+#include <dcxx/cache.hh>
+
+DCXX_BEGIN_NS_DC
+
+PageCache::PageCache()
+    : pageSize(0), hits(0), misses(0)
+{
+}
+
+void
+PageCache::setPageSize(unsigned int size)
+{
+    pageSize = size;
+    pages.clear();
+}
+
+const unsigned char *
+PageCache::find(unsigned int page) const
+{
+    PageMap::const_iterator it(pages.find(page));
+    return it != pages.end() ? &it->second[0] : NULL;
+}
+
+void
+PageCache::insert(unsigned int page, const unsigned char *data)
+{
+    pages[page].assign(data, data + pageSize);
+}
+
+void
+PageCache::invalidate(unsigned int addr, unsigned int size)
+{
+    if (!pageSize || !size)
+	return;
+
+    pages.erase(pages.lower_bound(addr / pageSize),
+		pages.upper_bound((addr + size - 1) / pageSize));
+}
+
+void
+PageCache::clear()
+{
+    pages.clear();
+}
+
+DCXX_END_NS
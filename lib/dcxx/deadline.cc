@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <dcxx/utils.hh>
+#include <dcxx/deadline.hh>
+#include <dcxx/stats.hh>
+
+DCXX_BEGIN_NS_DC
+
+Deadline::Deadline()
+    : total(0), perDive(0), started(0), lastProgress(0), reason(NONE)
+{
+}
+
+void
+Deadline::start()
+{
+    started = lastProgress = TransferStats::now();
+    reason = NONE;
+}
+
+void
+Deadline::progress()
+{
+    lastProgress = TransferStats::now();
+}
+
+bool
+Deadline::expired()
+{
+    if (reason != NONE)
+	return true;
+
+    const uint64_t now(TransferStats::now());
+    if (total && now - started >= total)
+	reason = TOTAL;
+    else if (perDive && now - lastProgress >= perDive)
+	reason = PER_DIVE;
+
+    return reason != NONE;
+}
+
+const char *
+Deadline::what() const
+{
+    switch (reason) {
+    case TOTAL:
+	return "Time limit exceeded";
+    case PER_DIVE:
+	return "Time limit per dive exceeded";
+    default:
+	return "No time limit exceeded";
+    }
+}
+
+DCXX_END_NS
@@ -31,6 +31,13 @@
 #include <dcxx/utils.hh>
 #include <dcxx/device.hh>
 
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include <time.h>
+
 DCXX_BEGIN_NS_DC
 
 DeviceException::DeviceException(device_status_t status)
@@ -38,9 +45,18 @@ DeviceException::DeviceException(device_status_t status)
 {
 }
 
+DeviceException::DeviceException(device_status_t status,
+				 const std::string &msg)
+    : status(status), msg(msg)
+{
+}
+
 const char *
 DeviceException::what() const throw()
 {
+    if (!msg.empty())
+	return msg.c_str();
+
     switch (status) {
     case DEVICE_STATUS_SUCCESS:
 	return "No Error";
@@ -104,13 +120,21 @@ DeviceCallbacks::onEvent(Device &device,
 
 
 Device::Device(device_t *device)
-    : device(device), callbacks(NULL)
+    : device(device), callbacks(NULL), readGap(0), deviceReads(0),
+      retryPolicy(), retryBlockSize(0), retries(0),
+      delivered(), diveIndex(0), retrying(false), diveMismatch(false),
+      stats(), diveStart(0), pausedTime(0), waitingSince(0),
+      progressStart(0), progressBytes(0)
 {
     init();
 }
 
 Device::Device()
-    : device(NULL), callbacks(NULL)
+    : device(NULL), callbacks(NULL), readGap(0), deviceReads(0),
+      retryPolicy(), retryBlockSize(0), retries(0),
+      delivered(), diveIndex(0), retrying(false), diveMismatch(false),
+      stats(), diveStart(0), pausedTime(0), waitingSince(0),
+      progressStart(0), progressBytes(0)
 {
 }
 
@@ -173,41 +197,301 @@ void
 Device::read(unsigned int addr, void *data, unsigned int size)
     throw(DeviceException)
 {
-    DCXX_DEVICE_TRY(device_read(device, addr, (unsigned char *)data, size));
+    if (!cache.isEnabled()) {
+	readBlocks(addr, data, size);
+	return;
+    }
+
+    if (!size)
+	return;
+
+    const unsigned int pageSize(cache.getPageSize());
+    const unsigned int first(addr / pageSize);
+    const unsigned int last((addr + size - 1) / pageSize);
+
+    // Fetch every run of missing pages with a single read
+    for (unsigned int page = first; page <= last; ) {
+	if (cache.find(page)) {
+	    cache.hit();
+	    page++;
+	    continue;
+	}
+
+	unsigned int end(page + 1);
+	while (end <= last && !cache.find(end))
+	    end++;
+
+	std::vector<unsigned char> buf((end - page) * pageSize);
+	readBlocks(page * pageSize, &buf[0], buf.size());
+	for (unsigned int i = 0; i < end - page; i++) {
+	    cache.insert(page + i, &buf[i * pageSize]);
+	    cache.miss();
+	}
+
+	page = end;
+    }
+
+    unsigned char *out((unsigned char *)data);
+    for (unsigned int page = first; page <= last; page++) {
+	const unsigned int begin(std::max(addr, page * pageSize));
+	const unsigned int end(std::min(addr + size, (page + 1) * pageSize));
+
+	memcpy(out + (begin - addr),
+	       cache.find(page) + (begin - page * pageSize), end - begin);
+    }
+}
+
+static bool
+rangeLess(const ReadRange *a, const ReadRange *b)
+{
+    return a->addr < b->addr;
+}
+
+unsigned int
+Device::readv(const std::vector<ReadRange> &ranges) throw(DeviceException)
+{
+    std::vector<const ReadRange *> sorted;
+    for (std::vector<ReadRange>::const_iterator it = ranges.begin();
+	 it != ranges.end(); ++it) {
+	if (it->size)
+	    sorted.push_back(&*it);
+    }
+    std::sort(sorted.begin(), sorted.end(), rangeLess);
+
+    const unsigned int reads(deviceReads);
+    std::vector<unsigned char> buf;
+    for (unsigned int first = 0; first < sorted.size(); ) {
+	const unsigned int begin(sorted[first]->addr);
+	unsigned int end(begin + sorted[first]->size);
+
+	// Extend the read while the next range starts close enough
+	unsigned int last(first + 1);
+	while (last < sorted.size() &&
+	       sorted[last]->addr - std::min(sorted[last]->addr, end) <=
+	       readGap) {
+	    end = std::max(end, sorted[last]->addr + sorted[last]->size);
+	    last++;
+	}
+
+	buf.resize(end - begin);
+	read(begin, &buf[0], buf.size());
+
+	for (unsigned int i = first; i < last; i++)
+	    memcpy(sorted[i]->data, &buf[sorted[i]->addr - begin],
+		   sorted[i]->size);
+
+	first = last;
+    }
+
+    return deviceReads - reads;
 }
 
 void
 Device::write(unsigned int addr, void *data, unsigned int size)
     throw(DeviceException)
+{
+    // Invalidate before writing, a failed write may still have
+    // changed the device's memory.
+    cache.invalidate(addr, size);
+    writeDevice(addr, data, size);
+}
+
+void
+Device::readDevice(unsigned int addr, void *data, unsigned int size)
+    throw(DeviceException)
+{
+    DCXX_DEVICE_TRY(device_read(device, addr, (unsigned char *)data, size));
+}
+
+void
+Device::writeDevice(unsigned int addr, void *data, unsigned int size)
+    throw(DeviceException)
 {
     DCXX_DEVICE_TRY(device_write(device, addr, (unsigned char *)data, size));
 }
 
 void
 Device::forEach() throw(DeviceException)
+{
+    delivered.clear();
+    diveMismatch = false;
+    retrying = false;
+
+    unsigned int attempt(0);
+    while (true) {
+	const unsigned int before(delivered.size());
+	diveIndex = 0;
+
+	const uint64_t start(TransferStats::now());
+	diveStart = start;
+	pausedTime = 0;
+	waitingSince = 0;
+	progressStart = start;
+	progressBytes = 0;
+
+	try {
+	    forEachDevice();
+	    progressStart = 0;
+	    endWait();
+	    stats.addTransferTime(TransferStats::now() - start - pausedTime);
+	    break;
+	} catch (DeviceException e) {
+	    progressStart = 0;
+	    endWait();
+	    stats.addTransferTime(TransferStats::now() - start - pausedTime);
+
+	    // Every dive that made it through counts as a successful
+	    // block, start over with the full number of retries.
+	    if (delivered.size() > before)
+		attempt = 0;
+
+	    if (diveMismatch || !retryAfter(e, attempt++)) {
+		retrying = false;
+		throw;
+	    }
+	    retrying = true;
+	}
+    }
+
+    retrying = false;
+    if (diveMismatch)
+	throw DeviceException(DEVICE_STATUS_PROTOCOL);
+}
+
+void
+Device::forEachDevice() throw(DeviceException)
 {
     DCXX_DEVICE_TRY(device_foreach(device, &Device::diveCallback, (void *)this));
 }
 
+void
+Device::readBlocks(unsigned int addr, void *data, unsigned int size)
+    throw(DeviceException)
+{
+    // Blocks are retried and can be cancelled individually
+    const unsigned int block(retryBlockSize ? retryBlockSize : size);
+    unsigned char *p((unsigned char *)data);
+
+    for (unsigned int done = 0; done < size; done += block) {
+	const unsigned int len(std::min(block, size - done));
+
+	// Long reads can be cancelled between blocks
+	if (done && emitCancel())
+	    throw DeviceException(DEVICE_STATUS_CANCELLED);
+
+	for (unsigned int attempt = 0; ; attempt++) {
+	    const uint64_t start(TransferStats::now());
+	    deviceReads++;
+	    try {
+		readDevice(addr + done, p + done, len);
+		const uint64_t time(TransferStats::now() - start);
+		stats.recordRead(len, time);
+		stats.addTransferTime(time);
+		break;
+	    } catch (DeviceException e) {
+		stats.addTransferTime(TransferStats::now() - start);
+		if (!retryAfter(e, attempt))
+		    throw;
+	    }
+	}
+    }
+}
+
+bool
+Device::retryAfter(const DeviceException &error, unsigned int attempt)
+{
+    switch (error.getStatus()) {
+    case DEVICE_STATUS_TIMEOUT:
+    case DEVICE_STATUS_PROTOCOL:
+    case DEVICE_STATUS_IO:
+	break;
+
+    default:
+	return false;
+    }
+
+    if (attempt >= retryPolicy.retries)
+	return false;
+
+    if (emitCancel())
+	throw DeviceException(DEVICE_STATUS_CANCELLED);
+
+    unsigned int delay(retryPolicy.initialDelay);
+    for (unsigned int i = 0; i < attempt && delay < retryPolicy.maxDelay; i++)
+	delay *= 2;
+    delay = std::min(delay, retryPolicy.maxDelay);
+
+    retries++;
+    if (callbacks)
+	callbacks->onRetry(*this, error, attempt + 1, delay);
+
+    struct timespec ts;
+    ts.tv_sec = delay / 1000;
+    ts.tv_nsec = (delay % 1000) * 1000000L;
+    const uint64_t start(TransferStats::now());
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+	;
+    stats.addWaitTime(TransferStats::now() - start);
+
+    return true;
+}
+
+void
+Device::emitEvent(device_event_t event, const void *data)
+{
+    eventCallback(device, event, data, this);
+}
+
+bool
+Device::emitCancel()
+{
+    return cancelCallback(this);
+}
+
+bool
+Device::emitDive(const void *data, unsigned int size,
+		 const void *fingerprint, unsigned int fsize)
+{
+    return diveCallback((const unsigned char *)data, size,
+			(const unsigned char *)fingerprint, fsize, this);
+}
+
 void
 Device::eventCallback(device_t *device, device_event_t event, const void *data,
 		      void *userdata)
 {
     Device *_this = static_cast<Device *>(userdata);
+    const uint64_t start(_this->beginCallback());
 
-    if (_this->callbacks)
+    if (event == DEVICE_EVENT_DEVINFO)
+	_this->stats.setSerial(((const device_devinfo_t *)data)->serial);
+    else if (event == DEVICE_EVENT_PROGRESS)
+	_this->recordProgress(*(const device_progress_t *)data, start);
+
+    // The device info has already been reported by the failed attempt
+    if (_this->callbacks &&
+	!(_this->retrying && event == DEVICE_EVENT_DEVINFO))
 	_this->callbacks->onEvent(*_this, event, data);
+
+    _this->endCallback(start);
+
+    // The device waits for the user until it sends something else
+    if (event == DEVICE_EVENT_WAITING)
+	_this->waitingSince = TransferStats::now();
 }
 
 int
 Device::cancelCallback(void *userdata)
 {
     Device *_this = static_cast<Device *>(userdata);
+    const uint64_t start(_this->beginCallback());
+    int ret(0);
 
     if (_this->callbacks)
-	return _this->callbacks->onCancel(*_this) ? 1 : 0;
-    else
-	return 0;
+	ret = _this->callbacks->onCancel(*_this) ? 1 : 0;
+
+    _this->endCallback(start);
+    return ret;
 }
 
 int
@@ -216,12 +500,95 @@ Device::diveCallback(const unsigned char *data, unsigned int size,
 		     void *userdata)
 {
     Device *_this = static_cast<Device *>(userdata);
+    const uint64_t start(_this->beginCallback());
 
-    if (_this->callbacks)
-	return _this->callbacks->onDive(*_this, data, size, fingerprint, fsize)
+    const int ret(_this->deliverDive(data, size, fingerprint, fsize,
+				     start - _this->diveStart));
+
+    _this->endCallback(start);
+    _this->diveStart = TransferStats::now();
+    return ret;
+}
+
+int
+Device::deliverDive(const unsigned char *data, unsigned int size,
+		    const unsigned char *fingerprint, unsigned int fsize,
+		    uint64_t latency)
+{
+    // Skip the dives delivered before the download was retried, they
+    // are sent newest first and should arrive in the same order.
+    if (diveIndex < delivered.size()) {
+	const std::vector<unsigned char> &fp(delivered[diveIndex++]);
+	if (fp.size() != fsize ||
+	    !std::equal(fp.begin(), fp.end(), fingerprint)) {
+	    diveMismatch = true;
+	    return 0;
+	}
+	return 1;
+    }
+
+    stats.recordDive(size, latency);
+
+    diveIndex++;
+    delivered.push_back(
+	std::vector<unsigned char>(fingerprint, fingerprint + fsize));
+
+    if (callbacks)
+	return callbacks->onDive(*this, data, size, fingerprint, fsize)
 	    ? 1 : 0;
     else
 	return false;
 }
 
+void
+Device::recordProgress(const device_progress_t &progress, uint64_t now)
+{
+    // Downloads through libdivecomputer don't go through read(), the
+    // progress events are the only view of the transfer. Every step
+    // is counted as a read. A restarted download starts over at 0.
+    if (!progressStart)
+	return;
+
+    if (progress.current > progressBytes)
+	stats.recordRead(progress.current - progressBytes,
+			 now - progressStart);
+    progressBytes = progress.current;
+    progressStart = now;
+}
+
+uint64_t
+Device::beginCallback()
+{
+    endWait();
+    return TransferStats::now();
+}
+
+void
+Device::endCallback(uint64_t start)
+{
+    const uint64_t time(TransferStats::now() - start);
+
+    stats.addCallbackTime(time);
+    pausedTime += time;
+    diveStart += time;
+    if (progressStart)
+	progressStart += time;
+}
+
+void
+Device::endWait()
+{
+    if (!waitingSince)
+	return;
+
+    const uint64_t time(TransferStats::now() - waitingSince);
+    waitingSince = 0;
+
+    stats.addWaitTime(time);
+    pausedTime += time;
+    diveStart += time;
+    if (progressStart)
+	progressStart += time;
+}
+
 DCXX_END_NS
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <dcxx/utils.hh>
+#include <dcxx/memory.hh>
+
+#include <algorithm>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+/** Size of the simulated transfers */
+#define MEMORY_PACKET_SIZE 32U
+
+DCXX_BEGIN_NS_DC
+
+MemoryDevice::MemoryDevice(const char *name, const Options &_options)
+    throw(DeviceException)
+    : Device(), image(), options(_options), seed(_options.seed),
+      events((unsigned int)-1), fingerprint(), status(DEVICE_STATUS_SUCCESS)
+{
+    std::ifstream fin(name, std::ios::in | std::ios::binary);
+    if (!fin)
+	throw DeviceException(DEVICE_STATUS_IO);
+
+    image.assign(std::istreambuf_iterator<char>(fin),
+		 std::istreambuf_iterator<char>());
+    if (fin.bad())
+	throw DeviceException(DEVICE_STATUS_IO);
+
+    progress.current = 0;
+    progress.maximum = image.size();
+}
+
+MemoryDevice::~MemoryDevice() throw(DeviceException)
+{
+}
+
+void
+MemoryDevice::setEventMask(unsigned int _events) throw(DeviceException)
+{
+    events = _events;
+}
+
+void
+MemoryDevice::setFingerprint(const void *data, unsigned int size)
+    throw(DeviceException)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    fingerprint.assign(p, p + size);
+}
+
+void
+MemoryDevice::readDevice(unsigned int addr, void *data, unsigned int size)
+    throw(DeviceException)
+{
+    if (addr > image.size() || size > image.size() - addr)
+	throw DeviceException(DEVICE_STATUS_PROTOCOL);
+
+    transfer(size);
+    memcpy(data, &image[addr], size);
+}
+
+void
+MemoryDevice::writeDevice(unsigned int addr, void *data, unsigned int size)
+    throw(DeviceException)
+{
+    if (addr > image.size() || size > image.size() - addr)
+	throw DeviceException(DEVICE_STATUS_PROTOCOL);
+
+    transfer(size);
+    memcpy(&image[addr], data, size);
+}
+
+void
+MemoryDevice::transfer(unsigned int size) throw(DeviceException)
+{
+    // Transfer in packets, the download can be cancelled between
+    // them like with a real device.
+    for (unsigned int done = 0; done < size; done += MEMORY_PACKET_SIZE) {
+	if (done && emitCancel())
+	    throw DeviceException(DEVICE_STATUS_CANCELLED);
+
+	const unsigned int len(std::min(size - done, MEMORY_PACKET_SIZE));
+	const useconds_t delay(len * options.latency);
+	if (delay)
+	    usleep(delay);
+    }
+
+    if (options.errorRate > 0 &&
+	rand_r(&seed) < options.errorRate * RAND_MAX)
+	throw DeviceException(options.error);
+}
+
+void
+MemoryDevice::event(device_event_t event, const void *data)
+{
+    if (events & event)
+	emitEvent(event, data);
+}
+
+void
+MemoryDevice::beginForEach()
+{
+    status = DEVICE_STATUS_SUCCESS;
+    progress.current = 0;
+    progress.maximum = image.size();
+    event(DEVICE_EVENT_PROGRESS, &progress);
+}
+
+bool
+MemoryDevice::dive(const void *data, unsigned int size,
+		   const void *fp, unsigned int fsize)
+{
+    if (emitCancel()) {
+	status = DEVICE_STATUS_CANCELLED;
+	return false;
+    }
+
+    // Dives are reported newest first, stop at the newest dive that
+    // has already been downloaded.
+    if (!fingerprint.empty() && fsize == fingerprint.size() &&
+	memcmp(fp, &fingerprint[0], fsize) == 0)
+	return false;
+
+    try {
+	transfer(size);
+    } catch (DeviceException e) {
+	status = e.getStatus();
+	return false;
+    }
+
+    progress.current += size;
+    if (progress.current > progress.maximum)
+	progress.current = progress.maximum;
+    event(DEVICE_EVENT_PROGRESS, &progress);
+
+    return emitDive(data, size, fp, fsize);
+}
+
+DCXX_END_NS
@@ -29,6 +29,7 @@
  */
 
 #include <dcxx/parser.hh>
+#include <dcxx/profile.hh>
 #include <dcxx/utils.hh>
 
 #include <stdlib.h>
@@ -36,6 +37,47 @@
 
 DCXX_BEGIN_NS_DC
 
+namespace {
+    /** Appends the samples of a dive to a DiveProfile */
+    class ProfileBuilder
+	: public SampleHandler<ProfileBuilder>
+    {
+    public:
+	ProfileBuilder(DiveProfile &_profile)
+	    : profile(_profile) {}
+
+	void onTime(Duration time) {
+	    profile.addSample(time);
+	}
+
+	// Fields reported before the first time stamp have no sample
+	// to belong to and are dropped.
+	void onDepth(Length depth) {
+	    if (!profile.empty())
+		profile.setDepth(depth);
+	}
+
+	void onTemperature(Temperature temp) {
+	    if (!profile.empty())
+		profile.setTemperature(temp);
+	}
+
+	void onPressure(unsigned int tank, double value) {
+	    if (!profile.empty())
+		profile.setPressure(tank, value);
+	}
+
+	void onEvent(parser_sample_event_t type, Duration time,
+		     unsigned int flags, unsigned int value) {
+	    if (!profile.empty())
+		profile.addEvent(type, time, flags, value);
+	}
+
+    private:
+	DiveProfile &profile;
+    };
+}
+
 ParserException::ParserException(parser_status_t status)
     : status(status)
 {
@@ -72,7 +114,7 @@ ParserException::getStatus() const throw()
 
 
 ParserCallbacks::ParserCallbacks()
-    : inSample(false)
+    : SampleHandler<ParserCallbacks>()
 {
 }
 
@@ -85,73 +127,27 @@ ParserCallbacks::onSample(Parser &parser,
 			  parser_sample_type_t type,
 			  parser_sample_value_t value)
 {
-    switch (type) {
-    case SAMPLE_TYPE_TIME:
-	terminateSample();
-	beginSample();
-	onTime(Duration::seconds(value.time));
-	break;
-
-    case SAMPLE_TYPE_DEPTH:
-	onDepth(Length::metre(value.depth));
-	break;
-
-    case SAMPLE_TYPE_PRESSURE:
-	onPressure(value.pressure.tank, value.pressure.value);
-	break;
-
-    case SAMPLE_TYPE_TEMPERATURE:
-	onTemperature(Temperature::celsius(value.temperature));
-	break;
-
-    case SAMPLE_TYPE_EVENT:
-	onEvent((parser_sample_event_t)value.event.type,
-		Duration::seconds(value.event.time),
-		value.event.flags, value.event.value);
-	break;
-
-    case SAMPLE_TYPE_RBT:
-	onRBT(value.rbt);
-	break;
-
-    case SAMPLE_TYPE_HEARTBEAT:
-	onHeartBeat(value.heartbeat);
-	break;
-
-    case SAMPLE_TYPE_BEARING:
-	onBearing(value.bearing);
-	break;
-
-    case SAMPLE_TYPE_VENDOR:
-	onVendor(value.vendor.type, value.vendor.size, value.vendor.data);
-	break;
-    }
-}
-
-void
-ParserCallbacks::beginSample()
-{
-    inSample = true;
-    onBeginSample();
+    dispatchSample(type, value);
 }
 
-void
-ParserCallbacks::terminateSample()
+DiveHeader::DiveHeader()
+    : dateTime(0), dateTimeStatus(PARSER_STATUS_UNSUPPORTED),
+      diveTimeStatus(PARSER_STATUS_UNSUPPORTED),
+      maxDepthStatus(PARSER_STATUS_UNSUPPORTED),
+      gasMixesStatus(PARSER_STATUS_UNSUPPORTED)
 {
-    if (inSample) {
-	onEndSample();
-	inSample = false;
-    }
 }
 
 Parser::Parser(parser_t *parser)
-    : parser(parser), callbacks(NULL)
+    : parser(parser), callbacks(NULL), data(NULL), size(0),
+      headerDecoded(0)
 {
     init();
 }
 
 Parser::Parser()
-    : parser(NULL)
+    : parser(NULL), callbacks(NULL), data(NULL), size(0),
+      headerDecoded(0)
 {
 }
 
@@ -169,6 +165,14 @@ Parser::init() throw(ParserException)
 void
 Parser::setData(const void *data, unsigned int size) throw(ParserException)
 {
+    // Forget the old dive first, libdivecomputer may have dropped it
+    // even if the new data is rejected.
+    this->data = data;
+    this->size = size;
+    if (headerDecoded) {
+	header = DiveHeader();
+	headerDecoded = 0;
+    }
     DCXX_PARSER_TRY(parser_set_data(parser, (const unsigned char *)data, size));
 }
 
@@ -189,37 +193,71 @@ Parser::forEachSample() throw(ParserException)
 {
     DCXX_PARSER_TRY(
 	parser_samples_foreach(parser, &Parser::sampleCallback, (void *)this));
-    callbacks->terminateSample();
+    if (callbacks)
+	callbacks->terminateSample();
 }
 
-Duration
-Parser::getDiveTime() throw(ParserException)
+void
+Parser::getProfile(DiveProfile &profile) throw(ParserException)
 {
-    return Duration::seconds(getField<unsigned int>(FIELD_TYPE_DIVETIME, 0));
+    ProfileBuilder builder(profile);
+
+    profile.clear();
+    // Samples take up at least a byte of the raw dive in the formats
+    // we support, so its size bounds the number of samples. Reserving
+    // it up front avoids reallocating the channels while decoding.
+    profile.reserve(size);
+    forEachSample(builder);
 }
 
-Length
-Parser::getMaxDepth() throw(ParserException)
+parser_status_t
+Parser::tryGetDiveTime(Duration &time) throw()
 {
-    return Length::metre(getField<double>(FIELD_TYPE_MAXDEPTH, 0));
+    unsigned int seconds;
+    parser_status_t status(tryGetField(FIELD_TYPE_DIVETIME, 0, seconds));
+    if (status == PARSER_STATUS_SUCCESS)
+	time = Duration::seconds(seconds);
+    return status;
 }
 
-Parser::GasMixVector &
-Parser::getGasMixes(GasMixVector &mixes) throw(ParserException)
+parser_status_t
+Parser::tryGetMaxDepth(Length &depth) throw()
 {
-    unsigned int count = getField<unsigned int>(FIELD_TYPE_GASMIX_COUNT, 0);
-    mixes.resize(count);
-    for (unsigned int i = 0; i < count; i++)
-	getField(FIELD_TYPE_GASMIX, i, &mixes[i]);
+    double metre;
+    parser_status_t status(tryGetField(FIELD_TYPE_MAXDEPTH, 0, metre));
+    if (status == PARSER_STATUS_SUCCESS)
+	depth = Length::metre(metre);
+    return status;
 }
 
-time_t
-Parser::getDateTime() throw(ParserException)
+parser_status_t
+Parser::tryGetGasMixes(GasMixVector &mixes) throw()
+{
+    unsigned int count;
+    parser_status_t status(tryGetField(FIELD_TYPE_GASMIX_COUNT, 0, count));
+    if (status != PARSER_STATUS_SUCCESS)
+	return status;
+
+    GasMixVector found(count);
+    for (unsigned int i = 0; i < count; i++) {
+	status = tryGetField(FIELD_TYPE_GASMIX, i, (void *)&found[i]);
+	if (status != PARSER_STATUS_SUCCESS)
+	    return status;
+    }
+
+    mixes.swap(found);
+    return PARSER_STATUS_SUCCESS;
+}
+
+parser_status_t
+Parser::tryGetDateTime(time_t &time) throw()
 {
     dc_datetime_t dt;
     struct tm tm;
 
-    DCXX_PARSER_TRY(parser_get_datetime(parser, &dt));
+    parser_status_t status(parser_get_datetime(parser, &dt));
+    if (status != PARSER_STATUS_SUCCESS)
+	return status;
 
     memset(&tm, 0, sizeof(tm));
     tm.tm_year = dt.year - 1900;
@@ -230,14 +268,86 @@ Parser::getDateTime() throw(ParserException)
     tm.tm_sec = dt.second;
     tm.tm_isdst = -1;
 
-    return mktime(&tm);
+    time = mktime(&tm);
+    return PARSER_STATUS_SUCCESS;
+}
+
+parser_status_t
+Parser::tryGetField(parser_field_type_t type, unsigned int flags,
+		    void *value) throw()
+{
+    return parser_get_field(parser, type, flags, value);
+}
+
+const DiveHeader &
+Parser::getHeader() throw()
+{
+    return decodeHeader(HEADER_ALL);
+}
+
+/**
+ * Decode the header fields that haven't been decoded since setData()
+ *
+ * Fields are decoded one by one so that a caller that only wants,
+ * e.g., the depth doesn't pay for the time zone conversion of the
+ * date.
+ */
+const DiveHeader &
+Parser::decodeHeader(unsigned int fields) throw()
+{
+    const unsigned int missing(fields & ~headerDecoded);
+
+    if (missing & HEADER_DATETIME)
+	header.dateTimeStatus = tryGetDateTime(header.dateTime);
+    if (missing & HEADER_DIVETIME)
+	header.diveTimeStatus = tryGetDiveTime(header.diveTime);
+    if (missing & HEADER_MAXDEPTH)
+	header.maxDepthStatus = tryGetMaxDepth(header.maxDepth);
+    if (missing & HEADER_GASMIXES)
+	header.gasMixesStatus = tryGetGasMixes(header.gasMixes);
+    headerDecoded |= missing;
+
+    return header;
+}
+
+Duration
+Parser::getDiveTime() throw(ParserException)
+{
+    const DiveHeader &header(decodeHeader(HEADER_DIVETIME));
+    DCXX_PARSER_TRY(header.diveTimeStatus);
+    return header.diveTime;
+}
+
+Length
+Parser::getMaxDepth() throw(ParserException)
+{
+    const DiveHeader &header(decodeHeader(HEADER_MAXDEPTH));
+    DCXX_PARSER_TRY(header.maxDepthStatus);
+    return header.maxDepth;
+}
+
+Parser::GasMixVector &
+Parser::getGasMixes(GasMixVector &mixes) throw(ParserException)
+{
+    const DiveHeader &header(decodeHeader(HEADER_GASMIXES));
+    DCXX_PARSER_TRY(header.gasMixesStatus);
+    mixes = header.gasMixes;
+    return mixes;
+}
+
+time_t
+Parser::getDateTime() throw(ParserException)
+{
+    const DiveHeader &header(decodeHeader(HEADER_DATETIME));
+    DCXX_PARSER_TRY(header.dateTimeStatus);
+    return header.dateTime;
 }
 
 void
 Parser::getField(parser_field_type_t type, unsigned int flags, void *value)
     throw(ParserException)
 {
-    DCXX_PARSER_TRY(parser_get_field(parser, type, flags, value));
+    DCXX_PARSER_TRY(tryGetField(type, flags, value));
 }
 
 void
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <dcxx/profile.hh>
+
+DCXX_BEGIN_NS_DC
+
+DiveProfile::DiveProfile()
+    : capacity(0), tanks(0)
+{
+    offsets.push_back(0);
+}
+
+void
+DiveProfile::clear()
+{
+    times.clear();
+    depths.clear();
+    depthValid.clear();
+    temperatures.clear();
+    temperatureValid.clear();
+
+    // The tank channels are kept as spares, the next dive most likely
+    // uses the same tanks.
+    for (unsigned int tank = 0; tank < tanks; tank++) {
+	pressures[tank].clear();
+	pressureValid[tank].clear();
+    }
+    tanks = 0;
+
+    events.clear();
+    offsets.clear();
+    offsets.push_back(0);
+}
+
+void
+DiveProfile::reserve(unsigned int samples)
+{
+    if (samples <= capacity)
+	return;
+
+    capacity = samples;
+    times.reserve(samples);
+    depths.reserve(samples);
+    depthValid.reserve(samples);
+    temperatures.reserve(samples);
+    temperatureValid.reserve(samples);
+    for (unsigned int tank = 0; tank < pressures.size(); tank++) {
+	pressures[tank].reserve(samples);
+	pressureValid[tank].reserve(samples);
+    }
+    offsets.reserve(samples + 1);
+}
+
+void
+DiveProfile::addSample(Duration time)
+{
+    times.push_back(time.seconds());
+    depths.push_back(0.0);
+    depthValid.push_back(false);
+    temperatures.push_back(0.0);
+    temperatureValid.push_back(false);
+    for (unsigned int tank = 0; tank < tanks; tank++) {
+	pressures[tank].push_back(0.0);
+	pressureValid[tank].push_back(false);
+    }
+    offsets.push_back(events.size());
+}
+
+void
+DiveProfile::setDepth(Length depth)
+{
+    depths.back() = depth.metre();
+    depthValid.back() = true;
+}
+
+void
+DiveProfile::setTemperature(Temperature temp)
+{
+    temperatures.back() = temp.kelvin();
+    temperatureValid.back() = true;
+}
+
+void
+DiveProfile::setPressure(unsigned int tank, double value)
+{
+    if (tank >= MAX_TANKS)
+	return;
+
+    while (tank >= tanks)
+	addTank();
+
+    pressures[tank].back() = value;
+    pressureValid[tank].back() = true;
+}
+
+void
+DiveProfile::addEvent(parser_sample_event_t type, Duration time,
+		      unsigned int flags, unsigned int value)
+{
+    Event event;
+    event.type = type;
+    event.time = (unsigned int)time.seconds();
+    event.flags = flags;
+    event.value = value;
+
+    events.push_back(event);
+    offsets.back() = events.size();
+}
+
+void
+DiveProfile::addTank()
+{
+    if (tanks == pressures.size()) {
+	pressures.push_back(Channel());
+	pressureValid.push_back(ValidMap());
+    }
+
+    // Spare channels were emptied by clear()
+    pressures[tanks].reserve(capacity);
+    pressures[tanks].resize(size(), 0.0);
+    pressureValid[tanks].reserve(capacity);
+    pressureValid[tanks].resize(size(), false);
+    tanks++;
+}
+
+DCXX_END_NS
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <dcxx/utils.hh>
+#include <dcxx/stats.hh>
+
+#include <algorithm>
+#include <sstream>
+
+#include <time.h>
+
+DCXX_BEGIN_NS_DC
+
+/** log2 of Histogram::SUB_BUCKETS */
+#define HISTOGRAM_SUB_BITS 4
+
+const unsigned int Histogram::SUB_BUCKETS;
+
+Histogram::Histogram()
+    : counts(), count(0), min(0), max(0), sum(0)
+{
+}
+
+unsigned int
+Histogram::bucketIndex(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+	return value;
+
+    // Values in [2^m, 2^(m+1)) are split into SUB_BUCKETS buckets
+    const unsigned int m(63 - __builtin_clzll(value));
+    const unsigned int shift(m - HISTOGRAM_SUB_BITS);
+
+    return SUB_BUCKETS + shift * SUB_BUCKETS +
+	((value >> shift) - SUB_BUCKETS);
+}
+
+uint64_t
+Histogram::getLower(unsigned int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+	return bucket;
+
+    const unsigned int shift((bucket - SUB_BUCKETS) / SUB_BUCKETS);
+    const unsigned int sub((bucket - SUB_BUCKETS) % SUB_BUCKETS);
+
+    return (uint64_t)(SUB_BUCKETS + sub) << shift;
+}
+
+uint64_t
+Histogram::getUpper(unsigned int bucket)
+{
+    if (bucket < SUB_BUCKETS)
+	return bucket + 1;
+
+    const unsigned int shift((bucket - SUB_BUCKETS) / SUB_BUCKETS);
+    return getLower(bucket) + ((uint64_t)1 << shift);
+}
+
+void
+Histogram::record(uint64_t value)
+{
+    const unsigned int bucket(bucketIndex(value));
+    if (bucket >= counts.size())
+	counts.resize(bucket + 1, 0);
+    counts[bucket]++;
+
+    if (!count || value < min)
+	min = value;
+    if (value > max)
+	max = value;
+    count++;
+    sum += value;
+}
+
+void
+Histogram::clear()
+{
+    counts.clear();
+    count = min = max = sum = 0;
+}
+
+uint64_t
+Histogram::getPercentile(double fraction) const
+{
+    if (!count)
+	return 0;
+
+    const uint64_t target(fraction * count + 0.5);
+    uint64_t seen(0);
+    for (unsigned int i = 0; i < counts.size(); i++) {
+	seen += counts[i];
+	if (seen >= target && seen)
+	    return std::min(std::max(getUpper(i) - 1, min), max);
+    }
+
+    return max;
+}
+
+
+TransferStats::TransferStats()
+    : reads(0), readBytes(0), dives(0), diveBytes(0),
+      transferTime(0), waitTime(0), callbackTime(0),
+      readLatency(), diveLatency(),
+      serial(0), serialValid(false)
+{
+}
+
+void
+TransferStats::clear()
+{
+    *this = TransferStats();
+}
+
+uint64_t
+TransferStats::now()
+{
+    // A monotonic clock keeps time limits and latencies sane if the
+    // wall clock is adjusted during a session.
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+TransferStats::recordRead(unsigned int bytes, uint64_t time)
+{
+    reads++;
+    readBytes += bytes;
+    readLatency.record(time);
+}
+
+void
+TransferStats::recordDive(unsigned int bytes, uint64_t time)
+{
+    dives++;
+    diveBytes += bytes;
+    diveLatency.record(time);
+}
+
+double
+TransferStats::getThroughput() const
+{
+    // Dives arrive through the reads if there are any, don't count
+    // their bytes twice.
+    return transferTime ?
+	(reads ? readBytes : diveBytes) * 1000000.0 / transferTime : 0;
+}
+
+static void
+printHistogram(std::ostream &out, const char *name, const Histogram &h)
+{
+    if (!h.getCount())
+	return;
+
+    out << "  " << name << " (ms): "
+	<< "min " << h.getMin() / 1000.0
+	<< ", mean " << h.getMean() / 1000.0
+	<< ", p50 " << h.getPercentile(0.5) / 1000.0
+	<< ", p90 " << h.getPercentile(0.9) / 1000.0
+	<< ", p99 " << h.getPercentile(0.99) / 1000.0
+	<< ", max " << h.getMax() / 1000.0 << std::endl;
+}
+
+void
+TransferStats::print(std::ostream &out, const std::string &device) const
+{
+    out << "Transfer statistics for " << device;
+    if (serialValid)
+	out << " (serial " << serial << ")";
+    out << ":" << std::endl;
+
+    if (reads)
+	out << "  Memory: " << readBytes << " bytes in " << reads
+	    << " reads" << std::endl;
+    if (dives)
+	out << "  Dives: " << diveBytes << " bytes in " << dives
+	    << " dives" << std::endl;
+    out << "  Throughput: " << getThroughput() << " bytes/s" << std::endl
+	<< "  Time: " << transferTime / 1000000.0 << " s transferring, "
+	<< waitTime / 1000000.0 << " s waiting, "
+	<< callbackTime / 1000000.0 << " s in callbacks" << std::endl;
+
+    printHistogram(out, "Read latency", readLatency);
+    printHistogram(out, "Dive latency", diveLatency);
+}
+
+void
+TransferStats::dumpHistogram(std::ostream &out, const std::string &prefix,
+			     const char *name,
+			     const Histogram &histogram) const
+{
+    for (unsigned int i = 0; i < histogram.getBuckets(); i++) {
+	if (histogram.getBucketCount(i))
+	    out << prefix << name << ","
+		<< Histogram::getLower(i) << ","
+		<< Histogram::getUpper(i) << ","
+		<< histogram.getBucketCount(i) << std::endl;
+    }
+}
+
+void
+TransferStats::dump(std::ostream &out, const std::string &device) const
+{
+    std::ostringstream ss;
+    ss << device << ",";
+    if (serialValid)
+	ss << serial;
+    ss << ",";
+    const std::string prefix(ss.str());
+
+    out << prefix << "reads," << reads << std::endl
+	<< prefix << "read_bytes," << readBytes << std::endl
+	<< prefix << "dives," << dives << std::endl
+	<< prefix << "dive_bytes," << diveBytes << std::endl
+	<< prefix << "transfer_us," << transferTime << std::endl
+	<< prefix << "wait_us," << waitTime << std::endl
+	<< prefix << "callback_us," << callbackTime << std::endl
+	<< prefix << "bytes_per_s," << getThroughput() << std::endl;
+
+    dumpHistogram(out, prefix, "read_latency_us", readLatency);
+    dumpHistogram(out, prefix, "dive_latency_us", diveLatency);
+}
+
+DCXX_END_NS
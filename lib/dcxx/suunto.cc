@@ -31,6 +31,10 @@
 #include <dcxx/utils.hh>
 #include <dcxx/suunto.hh>
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -44,19 +48,60 @@
 #endif
 
 #define VYPER_CONFIG_OFFSET 0x1E
+#define VYPER_DEVINFO_OFFSET 0x24
+#define VYPER_DEVINFO_SIZE 6
+#define VYPER_MEMORY_SIZE 0x2000
+/** Vyper memory is transferred in packets of this size */
+#define VYPER_PAGE_SIZE 32
+/**
+ * Unneeded bytes worth reading to save a round trip. A command takes
+ * about as long as transferring four packets at 2400 baud.
+ */
+#define VYPER_READ_GAP (4 * VYPER_PAGE_SIZE)
+
+/** Number of reads that have to succeed at a delay */
+#define VYPER_TUNE_PROBES 3
+/** Number of reads confirming the final delay */
+#define VYPER_TUNE_CONFIRM_PROBES 32
+/** Stop tuning when the delay is known within this many ms */
+#define VYPER_TUNE_STEP 10
+#define VYPER_TUNE_MAX_DELAY 5000
 
 #define VYPER_ALARM_FLAG_TIME 0x01
 #define VYPER_ALARM_FLAG_DEPTH 0x02
 
+/**
+ * Decode a serial number the way libdivecomputer reports it in
+ * DEVICE_EVENT_DEVINFO, one decimal digit pair per byte
+ */
+static unsigned int
+decodeSerial(const void *data)
+{
+    const unsigned char *p((const unsigned char *)data);
+    unsigned int serial(0);
+
+    for (int i = 0; i < 4; i++)
+	serial = serial * 100 + p[i];
+
+    return serial;
+}
+
 DCXX_BEGIN_NS_DC
 DCXX_BEGIN_NS_SUUNTO
 
+const unsigned int Vyper::DEFAULT_DELAY;
+const unsigned int Vyper::MEMORY_SIZE;
+const unsigned int Vyper::PROFILE_BEGIN;
+const unsigned int Vyper::PROFILE_END;
 
 Vyper::Vyper(const char *name) throw(DeviceException)
-    : Device(), infoCacheValid(false)
+    : Device(), delay(DEFAULT_DELAY), restoredValid(false)
 {
     DCXX_DEVICE_TRY(suunto_vyper_device_open(&device, name));
     init();
+    setCachePageSize(VYPER_PAGE_SIZE);
+    setReadGap(VYPER_READ_GAP);
+    setRetryBlockSize(VYPER_PAGE_SIZE);
 }
 
 
@@ -84,6 +129,13 @@ Vyper::getSerial()
     return SUUNTO_SWAP32(getInfo().serial);
 }
 
+unsigned int
+Vyper::getDevInfoSerial()
+{
+    const Info info(getInfo());
+    return decodeSerial(&info.serial);
+}
+
 std::string
 Vyper::getPersonalInfo()
 {
@@ -169,22 +221,151 @@ Vyper::getAlarmDepthOn()
     return getInfo().alarmFlags & VYPER_ALARM_FLAG_DEPTH;
 }
 
-const Vyper::Info &
+unsigned int
+Vyper::getProfileEnd()
+{
+    return SUUNTO_SWAP16(getInfo().ptrRingBuff);
+}
+
+Vyper::InfoKey
+Vyper::getInfoKey()
+{
+    uint32_t serial;
+    uint16_t totalDives;
+    uint16_t ptrRingBuff;
+    std::vector<ReadRange> ranges;
+
+    ranges.push_back(ReadRange(VYPER_CONFIG_OFFSET + offsetof(Info, serial),
+			       sizeof(serial), &serial));
+    ranges.push_back(ReadRange(VYPER_CONFIG_OFFSET + offsetof(Info, totalDives),
+			       sizeof(totalDives), &totalDives));
+    ranges.push_back(ReadRange(VYPER_CONFIG_OFFSET + offsetof(Info, ptrRingBuff),
+			       sizeof(ptrRingBuff), &ptrRingBuff));
+    readv(ranges);
+
+    InfoKey key;
+    key.serial = SUUNTO_SWAP32(serial);
+    key.totalDives = SUUNTO_SWAP16(totalDives);
+    key.profileEnd = SUUNTO_SWAP16(ptrRingBuff);
+
+    return key;
+}
+
+bool
+Vyper::restoreInfo(const void *data, unsigned int size)
+{
+    Info info;
+
+    if (size != sizeof(info))
+	return false;
+    memcpy(&info, data, size);
+
+    const InfoKey key(getInfoKey());
+    if (SUUNTO_SWAP32(info.serial) != key.serial ||
+	SUUNTO_SWAP16(info.totalDives) != key.totalDives ||
+	SUUNTO_SWAP16(info.ptrRingBuff) != key.profileEnd)
+	return false;
+
+    restored = info;
+    restoredValid = true;
+    return true;
+}
+
+void
+Vyper::saveInfo(std::vector<char> &data)
+{
+    const Info info(getInfo());
+    const char *p((const char *)&info);
+
+    data.assign(p, p + sizeof(info));
+}
+
+Vyper::Info
 Vyper::getInfo()
 {
-    if (infoCacheValid)
-	return infoCache;
+    if (restoredValid)
+	return restored;
 
-    read(VYPER_CONFIG_OFFSET, &infoCache, sizeof(infoCache));
-    infoCacheValid = true;
+    Info info;
+    read(VYPER_CONFIG_OFFSET, &info, sizeof(info));
+    return info;
+}
 
-    return infoCache;
+void
+Vyper::writeDevice(unsigned int addr, void *data, unsigned int size)
+    throw(DeviceException)
+{
+    // The saved configuration may no longer match the device
+    restoredValid = false;
+    Device::writeDevice(addr, data, size);
 }
 
 void
 Vyper::setDelay(unsigned int delay) throw(DeviceException)
 {
     DCXX_DEVICE_TRY(suunto_vyper_device_set_delay(device, delay));
+    this->delay = delay;
+}
+
+bool
+Vyper::probeDelay(unsigned int delay, unsigned int probes)
+    throw(DeviceException)
+{
+    unsigned char buf[VYPER_DEVINFO_SIZE];
+
+    setDelay(delay);
+    for (unsigned int i = 0; i < probes; i++) {
+	if (emitCancel())
+	    throw DeviceException(DEVICE_STATUS_CANCELLED);
+
+	try {
+	    // Bypass the cache, every probe has to talk to the device
+	    readDevice(VYPER_DEVINFO_OFFSET, buf, sizeof(buf));
+	} catch (DeviceException e) {
+	    if (e.getStatus() == DEVICE_STATUS_PROTOCOL ||
+		e.getStatus() == DEVICE_STATUS_TIMEOUT)
+		return false;
+	    throw;
+	}
+    }
+
+    return true;
+}
+
+unsigned int
+Vyper::tuneDelay(unsigned int initial) throw(DeviceException)
+{
+    unsigned int good(std::max(initial, (unsigned int)VYPER_TUNE_STEP));
+    while (!probeDelay(good, VYPER_TUNE_PROBES)) {
+	if (good >= VYPER_TUNE_MAX_DELAY)
+	    throw DeviceException(DEVICE_STATUS_TIMEOUT);
+	good = std::min(good * 2, (unsigned int)VYPER_TUNE_MAX_DELAY);
+    }
+
+    // The shortest reliable delay is somewhere in (bad, good]
+    unsigned int bad(0);
+    while (good - bad > VYPER_TUNE_STEP) {
+	const unsigned int mid((bad + good) / 2);
+	if (probeDelay(mid, VYPER_TUNE_PROBES))
+	    good = mid;
+	else
+	    bad = mid;
+    }
+
+    // A few short probes passing right at the edge don't make a delay
+    // reliable for a whole download. Leave a margin and confirm it
+    // with a longer run of probes, backing off further if needed.
+    unsigned int delay(good + std::max(good / 4,
+				       (unsigned int)VYPER_TUNE_STEP));
+    delay = std::min(delay, (unsigned int)VYPER_TUNE_MAX_DELAY);
+    while (!probeDelay(delay, VYPER_TUNE_CONFIRM_PROBES)) {
+	if (delay >= VYPER_TUNE_MAX_DELAY)
+	    throw DeviceException(DEVICE_STATUS_TIMEOUT);
+	delay = std::min(delay + delay / 4,
+			 (unsigned int)VYPER_TUNE_MAX_DELAY);
+    }
+
+    return delay;
 }
 
 void
@@ -194,6 +375,68 @@ Vyper::readDive(dc_buffer_t *buffer, int init) throw(DeviceException)
 }
 
 
+VyperMemory::VyperMemory(const char *image, const Options &options)
+    throw(DeviceException)
+    : MemoryDevice(image, options)
+{
+    if (this->image.size() != VYPER_MEMORY_SIZE)
+	throw DeviceException(DEVICE_STATUS_ERROR);
+
+    setCachePageSize(VYPER_PAGE_SIZE);
+    setReadGap(VYPER_READ_GAP);
+    setRetryBlockSize(VYPER_PAGE_SIZE);
+}
+
+device_type_t
+VyperMemory::getType()
+{
+    return DEVICE_TYPE_SUUNTO_VYPER;
+}
+
+void
+VyperMemory::version(unsigned char *data, unsigned int size)
+    throw(DeviceException)
+{
+    if (size < VYPER_DEVINFO_SIZE)
+	throw DeviceException(DEVICE_STATUS_MEMORY);
+
+    transfer(VYPER_DEVINFO_SIZE);
+    memcpy(data, &image[VYPER_DEVINFO_OFFSET], VYPER_DEVINFO_SIZE);
+}
+
+void
+VyperMemory::forEachDevice() throw(DeviceException)
+{
+    const unsigned char *hdr(&image[VYPER_DEVINFO_OFFSET]);
+    device_devinfo_t devinfo;
+
+    beginForEach();
+
+    transfer(VYPER_DEVINFO_SIZE);
+    devinfo.model = hdr[0];
+    devinfo.firmware = hdr[1];
+    devinfo.serial = decodeSerial(hdr + 2);
+    event(DEVICE_EVENT_DEVINFO, &devinfo);
+
+    DCXX_DEVICE_TRY(suunto_vyper_extract_dives(NULL, &image[0], image.size(),
+					       &VyperMemory::diveCallback,
+					       this));
+
+    if (getStatus() != DEVICE_STATUS_SUCCESS)
+	throw DeviceException(getStatus());
+}
+
+int
+VyperMemory::diveCallback(const unsigned char *data, unsigned int size,
+			  const unsigned char *fingerprint, unsigned int fsize,
+			  void *userdata)
+{
+    VyperMemory *_this = static_cast<VyperMemory *>(userdata);
+
+    return _this->dive(data, size, fingerprint, fsize) ? 1 : 0;
+}
+
+
 VyperParser::VyperParser()
     : Parser()
 {
@@ -31,59 +31,68 @@
 #include "dev_common.hh"
 #include "dcxx/suunto.hh"
 
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+
+#include <pthread.h>
+
 #include <boost/foreach.hpp>
 
 const DeviceInfo devDevices[] = {
     { DEVICE_TYPE_SUUNTO_SOLUTION, PARSER_TYPE_SUUNTO_SOLUTION,
-      "suunto-solution" },
+      "suunto-solution", false },
     { DEVICE_TYPE_SUUNTO_EON, PARSER_TYPE_SUUNTO_EON,
-      "suunto-eon" },
+      "suunto-eon", false },
     { DEVICE_TYPE_SUUNTO_VYPER, PARSER_TYPE_SUUNTO_VYPER,
-      "suunto-vyper" },
+      "suunto-vyper", false },
     { DEVICE_TYPE_SUUNTO_VYPER2, PARSER_TYPE_NULL,
-      "suunto-vyper2" },
+      "suunto-vyper2", false },
     { DEVICE_TYPE_SUUNTO_D9, PARSER_TYPE_SUUNTO_D9,
-      "suunto-d9" },
+      "suunto-d9", false },
+    { DEVICE_TYPE_SUUNTO_VYPER, PARSER_TYPE_SUUNTO_VYPER,
+      "suunto-vyper-image", true },
 
     { DEVICE_TYPE_REEFNET_SENSUS, PARSER_TYPE_REEFNET_SENSUS,
-      "reefnet-sensus" },
+      "reefnet-sensus", false },
     { DEVICE_TYPE_REEFNET_SENSUSPRO, PARSER_TYPE_REEFNET_SENSUSPRO,
-      "reefnet-sensuspro" },
+      "reefnet-sensuspro", false },
     { DEVICE_TYPE_REEFNET_SENSUSULTRA, PARSER_TYPE_REEFNET_SENSUSULTRA,
-      "reefnet-sensusultra" },
+      "reefnet-sensusultra", false },
 
     { DEVICE_TYPE_UWATEC_ALADIN, PARSER_TYPE_NULL,
-      "uwatec-aladin" },
+      "uwatec-aladin", false },
     { DEVICE_TYPE_UWATEC_MEMOMOUSE, PARSER_TYPE_UWATEC_MEMOMOUSE,
-      "uwatec-memomouse" },
+      "uwatec-memomouse", false },
     { DEVICE_TYPE_UWATEC_SMART, PARSER_TYPE_UWATEC_SMART,
-      "uwatec-smart" },
+      "uwatec-smart", false },
 
     { DEVICE_TYPE_OCEANIC_ATOM2, PARSER_TYPE_OCEANIC_ATOM2,
-      "oceanic-atom2" },
+      "oceanic-atom2", false },
     { DEVICE_TYPE_OCEANIC_VEO250, PARSER_TYPE_OCEANIC_VEO250,
-      "oceanic-veo250" },
+      "oceanic-veo250", false },
     { DEVICE_TYPE_OCEANIC_VTPRO, PARSER_TYPE_OCEANIC_VTPRO,
-      "oceanic-vtpro" },
+      "oceanic-vtpro", false },
 
     { DEVICE_TYPE_MARES_NEMO, PARSER_TYPE_MARES_NEMO,
-      "mares-nemo" },
+      "mares-nemo", false },
     { DEVICE_TYPE_MARES_PUCK, PARSER_TYPE_NULL,
-      "mares-puck" },
+      "mares-puck", false },
     { DEVICE_TYPE_MARES_ICONHD, PARSER_TYPE_MARES_ICONHD,
-      "mares-iconhd" },
+      "mares-iconhd", false },
 
     { DEVICE_TYPE_HW_OSTC, PARSER_TYPE_HW_OSTC,
-      "hw-ostc" },
+      "hw-ostc", false },
 
     { DEVICE_TYPE_CRESSI_EDY, PARSER_TYPE_CRESSI_EDY,
-      "cressi-edy" },
+      "cressi-edy", false },
 
     { DEVICE_TYPE_ZEAGLE_N2ITION3, PARSER_TYPE_NULL,
-      "zeagle-n2ition3" },
+      "zeagle-n2ition3", false },
 
     { DEVICE_TYPE_ATOMICS_COBALT, PARSER_TYPE_ATOMICS_COBALT,
-      "atomics-cobalt" },
+      "atomics-cobalt", false },
 };
 
 const DeviceInfo *
@@ -110,10 +119,68 @@ getParserType(const char *devName)
     return devInfo ? devInfo->parser : PARSER_TYPE_NULL;
 }
 
+/**
+ * Split the port of a memory image device into the image name and
+ * its options
+ */
+static std::string
+parseImagePort(const char *port, dcxx::MemoryDevice::Options &options)
+{
+    std::istringstream ss(port);
+    std::string image, opt;
+
+    std::getline(ss, image, ',');
+    while (std::getline(ss, opt, ',')) {
+	const std::string::size_type eq(opt.find('='));
+	const std::string key(opt.substr(0, eq));
+	const std::string value(eq == std::string::npos ?
+				"" : opt.substr(eq + 1));
+	std::istringstream vs(value);
+	bool ok(true);
+
+	if (key == "latency")
+	    ok = !(vs >> options.latency).fail() && options.latency >= 0;
+	else if (key == "error-rate")
+	    ok = !(vs >> options.errorRate).fail() &&
+		options.errorRate >= 0 && options.errorRate <= 1;
+	else if (key == "seed")
+	    ok = !(vs >> options.seed).fail();
+	else if (key == "error") {
+	    if (value == "timeout")
+		options.error = DEVICE_STATUS_TIMEOUT;
+	    else if (value == "protocol")
+		options.error = DEVICE_STATUS_PROTOCOL;
+	    else if (value == "io")
+		options.error = DEVICE_STATUS_IO;
+	    else
+		ok = false;
+	} else
+	    ok = false;
+
+	// Devices are opened by the fleet's worker threads, so a bad
+	// option must only fail its own session.
+	if (!ok)
+	    throw dcxx::DeviceException(
+		DEVICE_STATUS_ERROR,
+		"Invalid memory image option '" + opt + "'");
+    }
+
+    return image;
+}
+
 dcxx::Device *
-devCreate(device_type_t type, const char *port)
+devCreate(const DeviceInfo &info, const char *port)
 {
-    switch (type) {
+    if (info.image) {
+	if (info.device != DEVICE_TYPE_SUUNTO_VYPER)
+	    return NULL;
+
+	dcxx::MemoryDevice::Options options;
+	const std::string image(parseImagePort(port, options));
+	return new dcxx::suunto::VyperMemory(image.c_str(), options);
+    }
+
+    switch (info.device) {
     case DEVICE_TYPE_SUUNTO_VYPER:
 	return new dcxx::suunto::Vyper(port);
     case DEVICE_TYPE_SUUNTO_VYPER2:
@@ -133,3 +200,75 @@ parserCreate(parser_type_t type)
 	return NULL;
     }
 }
+
+ParserPool::ParserPool()
+{
+}
+
+ParserPool::~ParserPool()
+{
+    for (ParserMap::iterator it(parsers.begin()); it != parsers.end(); ++it)
+	delete it->second;
+}
+
+dcxx::Parser *
+ParserPool::get(parser_type_t type)
+{
+    dcxx::Parser *parser;
+    ParserMap::iterator it(parsers.find(type));
+    if (it != parsers.end())
+	parser = it->second;
+    else {
+	parser = parserCreate(type);
+	if (!parser)
+	    return NULL;
+	parsers[type] = parser;
+    }
+
+    // Don't let the parser call back into the previous user's handler
+    parser->setCallbackHandler(NULL);
+    return parser;
+}
+
+static pthread_key_t poolKey;
+static pthread_once_t poolKeyOnce = PTHREAD_ONCE_INIT;
+
+static void
+poolDestroy(void *pool)
+{
+    delete static_cast<ParserPool *>(pool);
+}
+
+static void
+poolExit()
+{
+    // Thread specific data destructors don't run for the main thread,
+    // which is the one calling exit handlers.
+    void *pool(pthread_getspecific(poolKey));
+    pthread_setspecific(poolKey, NULL);
+    poolDestroy(pool);
+}
+
+static void
+poolKeyCreate()
+{
+    if (pthread_key_create(&poolKey, poolDestroy)) {
+	std::cerr << "Error: Failed to create parser pool key" << std::endl;
+	exit(EXIT_FAILURE);
+    }
+    atexit(poolExit);
+}
+
+ParserPool &
+ParserPool::local()
+{
+    pthread_once(&poolKeyOnce, poolKeyCreate);
+
+    ParserPool *pool(static_cast<ParserPool *>(pthread_getspecific(poolKey)));
+    if (!pool) {
+	pool = new ParserPool();
+	pthread_setspecific(poolKey, pool);
+    }
+
+    return *pool;
+}
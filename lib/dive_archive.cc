@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dive_archive.hh"
+#include "dive_compress.hh"
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define ARCHIVE_DATA "dives.dat"
+#define ARCHIVE_INDEX "dives.idx"
+
+#define ARCHIVE_MAGIC "DTIX"
+#define ARCHIVE_VERSION 1
+
+#define ARCHIVE_HDR_SIZE 16
+#define ARCHIVE_REC_SIZE 56
+
+#define ARCHIVE_FLAG_COMPRESSED 0x01
+
+namespace bfs = boost::filesystem;
+
+using namespace std;
+
+/*
+ * All integers in the archive are stored in little endian byte order
+ * to make archives portable between machines.
+ */
+static void
+put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static void
+put64(uint8_t *p, uint64_t v)
+{
+    put32(p, v & 0xFFFFFFFF);
+    put32(p + 4, v >> 32);
+}
+
+static uint32_t
+get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+get64(const uint8_t *p)
+{
+    return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static void
+throwErrno(const string &what, const bfs::path &path)
+{
+    stringstream ss;
+    ss << what << " '" << path.string() << "': " << strerror(errno);
+    throw DiveStoreException(ss.str());
+}
+
+static void
+preadAll(int fd, void *data, size_t size, off_t offset, const bfs::path &path)
+{
+    char *p = (char *)data;
+
+    while (size > 0) {
+	ssize_t ret = pread(fd, p, size, offset);
+	if (ret == -1 && errno == EINTR)
+	    continue;
+	else if (ret == -1)
+	    throwErrno("Failed to read", path);
+	else if (ret == 0)
+	    throw DiveStoreException("Unexpected end of file in '" +
+				     path.string() + "'");
+	p += ret;
+	size -= ret;
+	offset += ret;
+    }
+}
+
+static void
+pwriteAll(int fd, const void *data, size_t size, off_t offset,
+	  const bfs::path &path)
+{
+    const char *p = (const char *)data;
+
+    while (size > 0) {
+	ssize_t ret = pwrite(fd, p, size, offset);
+	if (ret == -1 && errno == EINTR)
+	    continue;
+	else if (ret == -1)
+	    throwErrno("Failed to write", path);
+	p += ret;
+	size -= ret;
+	offset += ret;
+    }
+}
+
+ArchiveDiveStore::ArchiveDiveStore(const bfs::path &dir)
+    : dataPath(dir / ARCHIVE_DATA), indexPath(dir / ARCHIVE_INDEX),
+      dataFd(-1), indexFd(-1), writable(false),
+      count(0), dataEnd(0)
+{
+}
+
+ArchiveDiveStore::~ArchiveDiveStore()
+{
+    close();
+}
+
+bool
+ArchiveDiveStore::exists(const bfs::path &dir)
+{
+    return bfs::exists(dir / ARCHIVE_INDEX);
+}
+
+int
+ArchiveDiveStore::getLastDive()
+{
+    if (!bfs::exists(indexPath))
+	return -1;
+
+    open(false);
+    return (int)count - 1;
+}
+
+void
+ArchiveDiveStore::readDive(int no, vector<char> &data)
+{
+    Entry entry;
+
+    readEntry(no, entry);
+
+    data.resize(entry.size);
+    if (entry.size)
+	preadAll(dataFd, &data[0], entry.size, entry.offset, dataPath);
+
+    if (entry.flags & ARCHIVE_FLAG_COMPRESSED)
+	decompressDive(data);
+}
+
+void
+ArchiveDiveStore::readFingerprint(int no, vector<char> &fp)
+{
+    Entry entry;
+
+    readEntry(no, entry);
+    fp.assign(entry.fingerprint, entry.fingerprint + entry.fsize);
+}
+
+int
+ArchiveDiveStore::addDive(const void *data, unsigned int size,
+			  const void *fp, unsigned int fsize)
+{
+    Entry entry;
+    vector<char> cdata;
+
+    if (fsize > ARCHIVE_FP_MAX)
+	throw DiveStoreException("Fingerprint too large for dive archive");
+
+    if (compress) {
+	compressDive(data, size, cdata);
+	data = &cdata[0];
+	size = cdata.size();
+    }
+
+    open(true);
+
+    entry.offset = dataEnd;
+    entry.size = size;
+    entry.number = count;
+    entry.flags = compress ? ARCHIVE_FLAG_COMPRESSED : 0;
+    entry.fsize = fsize;
+    memset(entry.fingerprint, 0, sizeof(entry.fingerprint));
+    memcpy(entry.fingerprint, fp, fsize);
+
+    uint8_t rec[ARCHIVE_REC_SIZE];
+    encodeEntry(entry, rec);
+
+    // The dive has to be on disk before the index record that
+    // refers to it. The batch performs the operations in order.
+    batch.write(dataFd, data, size, entry.offset, dataPath.string());
+    batch.sync(dataFd, true, dataPath.string());
+    batch.write(indexFd, rec, sizeof(rec),
+		ARCHIVE_HDR_SIZE + (off_t)count * ARCHIVE_REC_SIZE,
+		indexPath.string());
+    batch.sync(indexFd, true, indexPath.string());
+    batch.submit();
+
+    dataEnd += size;
+    return count++;
+}
+
+void
+ArchiveDiveStore::open(bool write)
+{
+    struct stat st;
+    uint8_t hdr[ARCHIVE_HDR_SIZE];
+
+    if (indexFd != -1 && (writable || !write))
+	return;
+
+    close();
+
+    // Don't leave half an archive open behind a failed validation
+    try {
+	const int flags = write ? O_RDWR | O_CREAT : O_RDONLY;
+	indexFd = ::open(indexPath.string().c_str(), flags, 0666);
+	if (indexFd == -1)
+	    throwErrno("Failed to open", indexPath);
+
+	dataFd = ::open(dataPath.string().c_str(), flags, 0666);
+	if (dataFd == -1)
+	    throwErrno("Failed to open", dataPath);
+
+	writable = write;
+
+	if (fstat(indexFd, &st) == -1)
+	    throwErrno("Failed to stat", indexPath);
+
+	if (st.st_size == 0 && write) {
+	    memset(hdr, 0, sizeof(hdr));
+	    memcpy(hdr, ARCHIVE_MAGIC, 4);
+	    put32(hdr + 4, ARCHIVE_VERSION);
+	    put32(hdr + 8, ARCHIVE_REC_SIZE);
+	    pwriteAll(indexFd, hdr, sizeof(hdr), 0, indexPath);
+	    st.st_size = sizeof(hdr);
+	} else if (st.st_size < ARCHIVE_HDR_SIZE) {
+	    throw DiveStoreException("Invalid archive index '" +
+				     indexPath.string() + "'");
+	} else {
+	    preadAll(indexFd, hdr, sizeof(hdr), 0, indexPath);
+	    if (memcmp(hdr, ARCHIVE_MAGIC, 4) != 0 ||
+		get32(hdr + 4) != ARCHIVE_VERSION ||
+		get32(hdr + 8) != ARCHIVE_REC_SIZE)
+		throw DiveStoreException("Unsupported archive index '" +
+					 indexPath.string() + "'");
+	}
+
+	count = (st.st_size - ARCHIVE_HDR_SIZE) / ARCHIVE_REC_SIZE;
+	dataEnd = 0;
+	if (count) {
+	    Entry last;
+	    readEntry(count - 1, last);
+	    dataEnd = last.offset + last.size;
+	}
+
+	if (write) {
+	    // Discard anything left behind by an interrupted append
+	    if (ftruncate(indexFd,
+			  ARCHIVE_HDR_SIZE + (off_t)count * ARCHIVE_REC_SIZE) == -1)
+		throwErrno("Failed to truncate", indexPath);
+	    if (ftruncate(dataFd, dataEnd) == -1)
+		throwErrno("Failed to truncate", dataPath);
+	}
+    } catch (...) {
+	close();
+	throw;
+    }
+}
+
+void
+ArchiveDiveStore::close()
+{
+    if (indexFd != -1)
+	::close(indexFd);
+    if (dataFd != -1)
+	::close(dataFd);
+
+    indexFd = dataFd = -1;
+    writable = false;
+    count = 0;
+    dataEnd = 0;
+}
+
+void
+ArchiveDiveStore::readEntry(int no, Entry &entry)
+{
+    uint8_t rec[ARCHIVE_REC_SIZE];
+
+    open(false);
+    if (no < 0 || (unsigned int)no >= count) {
+	stringstream ss;
+	ss << "No dive " << no << " in archive";
+	throw DiveStoreException(ss.str());
+    }
+
+    preadAll(indexFd, rec, sizeof(rec),
+	     ARCHIVE_HDR_SIZE + (off_t)no * ARCHIVE_REC_SIZE, indexPath);
+
+    entry.offset = get64(rec);
+    entry.size = get32(rec + 8);
+    entry.number = get32(rec + 12);
+    entry.flags = get32(rec + 16);
+    entry.fsize = rec[20];
+    memcpy(entry.fingerprint, rec + 24, ARCHIVE_FP_MAX);
+
+    if (entry.number != (uint32_t)no || entry.fsize > ARCHIVE_FP_MAX)
+	throw DiveStoreException("Corrupt archive index '" +
+				 indexPath.string() + "'");
+}
+
+void
+ArchiveDiveStore::encodeEntry(const Entry &entry, uint8_t *rec)
+{
+    memset(rec, 0, ARCHIVE_REC_SIZE);
+    put64(rec, entry.offset);
+    put32(rec + 8, entry.size);
+    put32(rec + 12, entry.number);
+    put32(rec + 16, entry.flags);
+    rec[20] = entry.fsize;
+    memcpy(rec + 24, entry.fingerprint, ARCHIVE_FP_MAX);
+}
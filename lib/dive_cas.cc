@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dive_cas.hh"
+#include "dive_compress.hh"
+#include "sha256.hh"
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CAS_MANIFEST "manifest"
+#define CAS_OBJECT_LIST "objects.list"
+
+namespace bfs = boost::filesystem;
+
+using namespace std;
+
+static void
+throwErrno(const string &what, const bfs::path &path)
+{
+    stringstream ss;
+    ss << what << " '" << path.string() << "': " << strerror(errno);
+    throw DiveStoreException(ss.str());
+}
+
+/**
+ * Append a line to a file and sync it to disk
+ *
+ * @param valid Size of the file that holds complete lines, anything
+ *              after it is a partial line left by an interrupted
+ *              write. Files that are shared with other writers pass
+ *              -1 and are appended to without truncation.
+ */
+static void
+appendLine(const bfs::path &path, const string &line, int valid = -1)
+{
+    const char *p = line.c_str();
+    size_t size = line.length();
+    int fd;
+
+    fd = open(path.string().c_str(),
+	      O_WRONLY | O_CREAT | (valid < 0 ? O_APPEND : 0), 0666);
+    if (fd == -1)
+	throwErrno("Failed to open", path);
+
+    if (valid >= 0 &&
+	(ftruncate(fd, valid) == -1 || lseek(fd, valid, SEEK_SET) == -1)) {
+	close(fd);
+	throwErrno("Failed to truncate", path);
+    }
+
+    while (size > 0) {
+	ssize_t ret = write(fd, p, size);
+	if (ret == -1) {
+	    if (errno == EINTR)
+		continue;
+	    close(fd);
+	    throwErrno("Failed to write", path);
+	}
+	p += ret;
+	size -= ret;
+    }
+
+    if (fsync(fd) == -1) {
+	close(fd);
+	throwErrno("Failed to sync", path);
+    }
+
+    if (close(fd) == -1)
+	throwErrno("Failed to close", path);
+}
+
+/**
+ * Split a file into lines, ignoring a trailing partial line
+ *
+ * @return Size of the part of the file that holds complete lines
+ */
+static unsigned int
+readLines(const bfs::path &path, vector<string> &lines)
+{
+    vector<char> data;
+    unsigned int start = 0;
+
+    lines.clear();
+    if (!bfs::exists(path))
+	return 0;
+
+    readFile(path, data);
+    for (unsigned int i = 0; i < data.size(); i++) {
+	if (data[i] == '\n') {
+	    lines.push_back(string(&data[start], i - start));
+	    start = i + 1;
+	}
+    }
+
+    return start;
+}
+
+CasDiveStore::CasDiveStore(const bfs::path &dir, const bfs::path &_objectDir)
+    : manifestPath(dir / CAS_MANIFEST),
+      objectDir(_objectDir),
+      objectListPath(_objectDir / CAS_OBJECT_LIST),
+      manifestLoaded(false), manifestSize(0),
+      objectsLoaded(false), deduplicated(0)
+{
+}
+
+int
+CasDiveStore::getLastDive()
+{
+    loadManifest();
+    return (int)manifest.size() - 1;
+}
+
+void
+CasDiveStore::readDive(int no, vector<char> &data)
+{
+    loadManifest();
+    if (no < 0 || (unsigned int)no >= manifest.size()) {
+	stringstream ss;
+	ss << "No dive " << no << " in manifest";
+	throw DiveStoreException(ss.str());
+    }
+
+    // Objects may be shared with logbooks that don't compress dives,
+    // so both kinds of objects can be found.
+    const bfs::path path(objectPath(manifest[no].hash));
+    if (bfs::exists(path))
+	readFile(path, data);
+    else {
+	readFile(objectPath(manifest[no].hash, true), data);
+	decompressDive(data);
+    }
+}
+
+void
+CasDiveStore::readFingerprint(int no, vector<char> &fp)
+{
+    loadManifest();
+    if (no < 0 || (unsigned int)no >= manifest.size()) {
+	stringstream ss;
+	ss << "No dive " << no << " in manifest";
+	throw DiveStoreException(ss.str());
+    }
+
+    fp = manifest[no].fingerprint;
+}
+
+int
+CasDiveStore::addDive(const void *data, unsigned int size,
+		      const void *fp, unsigned int fsize)
+{
+    return addDiveRef(storeData(data, size), fp, fsize);
+}
+
+string
+CasDiveStore::storeData(const void *data, unsigned int size)
+{
+    loadObjects();
+
+    const string hash(SHA256::hexDigest(data, size));
+
+    if (objects.count(hash)) {
+	deduplicated++;
+	return hash;
+    }
+
+    const bfs::path path(objectPath(hash));
+
+    // The object may have been stored by someone else since the
+    // object list was loaded.
+    if (bfs::exists(path) || bfs::exists(objectPath(hash, true))) {
+	deduplicated++;
+    } else if (compress) {
+	vector<char> cdata;
+	compressDive(data, size, cdata);
+	bfs::create_directories(path.parent_path());
+	writeFileAtomic(objectPath(hash, true), &cdata[0], cdata.size());
+    } else {
+	bfs::create_directories(path.parent_path());
+	writeFileAtomic(path, data, size);
+    }
+
+    appendLine(objectListPath, hash + "\n");
+    objects.insert(hash);
+
+    return hash;
+}
+
+int
+CasDiveStore::addDiveRef(const string &ref, const void *fp, unsigned int fsize)
+{
+    Entry entry;
+
+    loadManifest();
+
+    if (ref.length() != 2 * SHA256_DIGEST_SIZE)
+	throw DiveStoreException("Invalid object reference '" + ref + "'");
+
+    entry.hash = ref;
+    entry.fingerprint.assign((const char *)fp, (const char *)fp + fsize);
+
+    const string line(entry.hash + " " + toHex(entry.fingerprint) + "\n");
+    appendLine(manifestPath, line, manifestSize);
+    manifestSize += line.length();
+
+    manifest.push_back(entry);
+    return manifest.size() - 1;
+}
+
+void
+CasDiveStore::loadManifest()
+{
+    vector<string> lines;
+
+    if (manifestLoaded)
+	return;
+
+    manifestSize = readLines(manifestPath, lines);
+    manifest.resize(lines.size());
+    for (unsigned int i = 0; i < lines.size(); i++) {
+	const string &line(lines[i]);
+	const size_t sep = line.find(' ');
+
+	if (sep != 2 * SHA256_DIGEST_SIZE ||
+	    !fromHex(line.substr(sep + 1), manifest[i].fingerprint))
+	    throw DiveStoreException("Corrupt manifest '" +
+				     manifestPath.string() + "'");
+
+	manifest[i].hash = line.substr(0, sep);
+    }
+
+    manifestLoaded = true;
+}
+
+void
+CasDiveStore::loadObjects()
+{
+    vector<string> lines;
+
+    if (objectsLoaded)
+	return;
+
+    bfs::create_directories(objectDir);
+    readLines(objectListPath, lines);
+    objects.insert(lines.begin(), lines.end());
+
+    objectsLoaded = true;
+}
+
+bfs::path
+CasDiveStore::objectPath(const string &hash, bool compressed) const
+{
+    return objectDir / hash.substr(0, 2) /
+	(hash.substr(2) + (compressed ? DIVE_COMPRESSED_EXT : ""));
+}
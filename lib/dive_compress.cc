@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dive_compress.hh"
+#include "dive_store.hh"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstring>
+#include <stdint.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define COMPRESS_MAGIC "DTZ\x01"
+#define COMPRESS_HDR_SIZE 8
+/** Best compression ratio deflate can achieve, bounds the raw size */
+#define COMPRESS_MAX_RATIO 1032
+
+using namespace std;
+
+static void
+put32(char *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static uint32_t
+get32(const char *_p)
+{
+    const uint8_t *p = (const uint8_t *)_p;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool
+haveDiveCompression()
+{
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+void
+compressDive(const void *data, unsigned int size, vector<char> &out)
+{
+#ifdef HAVE_ZLIB
+    uLongf csize = compressBound(size);
+
+    out.resize(COMPRESS_HDR_SIZE + csize);
+    memcpy(&out[0], COMPRESS_MAGIC, 4);
+    put32(&out[4], size);
+
+    if (compress2((Bytef *)&out[COMPRESS_HDR_SIZE], &csize,
+		  (const Bytef *)data, size, Z_BEST_COMPRESSION) != Z_OK)
+	throw DiveStoreException("Failed to compress dive");
+
+    out.resize(COMPRESS_HDR_SIZE + csize);
+#else
+    throw DiveStoreException("Compressed dives aren't supported by this build");
+#endif
+}
+
+void
+decompressDive(const void *_data, unsigned int size, vector<char> &out)
+{
+#ifdef HAVE_ZLIB
+    const char *data = (const char *)_data;
+
+    if (size < COMPRESS_HDR_SIZE)
+	throw DiveStoreException("Truncated compressed dive");
+
+    // The header only guards against data that was never compressed,
+    // callers know from where the dive is stored that it should be.
+    if (memcmp(data, COMPRESS_MAGIC, 4) != 0)
+	throw DiveStoreException("Dive isn't compressed");
+
+    // Don't let a corrupt size make us allocate gigabytes
+    uLongf rsize = get32(data + 4);
+    if (rsize > (uint64_t)(size - COMPRESS_HDR_SIZE) * COMPRESS_MAX_RATIO)
+	throw DiveStoreException("Corrupt compressed dive");
+
+    out.resize(rsize);
+    if (out.empty())
+	return;
+
+    if (uncompress((Bytef *)&out[0], &rsize,
+		   (const Bytef *)data + COMPRESS_HDR_SIZE,
+		   size - COMPRESS_HDR_SIZE) != Z_OK ||
+	rsize != out.size())
+	throw DiveStoreException("Corrupt compressed dive");
+#else
+    throw DiveStoreException("Compressed dives aren't supported by this build");
+#endif
+}
+
+void
+decompressDive(vector<char> &data)
+{
+    if (data.empty())
+	throw DiveStoreException("Truncated compressed dive");
+
+    vector<char> raw;
+    decompressDive(&data[0], data.size(), raw);
+    data.swap(raw);
+}
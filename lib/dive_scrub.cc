@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "dive_scrub.hh"
+#include "dive_store.hh"
+#include "crc32c.hh"
+
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem/fstream.hpp>
+
+namespace bfs = boost::filesystem;
+
+using namespace std;
+
+DiveChecksums::DiveChecksums(const bfs::path &_path)
+    : path(_path), loaded(false), sums()
+{
+}
+
+DiveChecksum
+DiveChecksums::get(int no)
+{
+    load();
+
+    return no >= 0 && (unsigned int)no < sums.size() ?
+	sums[no] : DiveChecksum();
+}
+
+void
+DiveChecksums::add(int no, uint32_t dive, uint32_t fingerprint)
+{
+    char line[32];
+    int fd;
+
+    load();
+
+    const int len(snprintf(line, sizeof(line), "%d %08x %08x\n",
+			   no, dive, fingerprint));
+
+    // A checksum that is lost in a crash only means that the dive
+    // can't be verified, so don't bother syncing.
+    fd = open(path.string().c_str(), O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (fd == -1 || write(fd, line, len) != len) {
+	stringstream ss;
+	ss << "Failed to write '" << path.string() << "': " << strerror(errno);
+	if (fd != -1)
+	    close(fd);
+	throw DiveStoreException(ss.str());
+    }
+    close(fd);
+
+    if ((unsigned int)no >= sums.size())
+	sums.resize(no + 1);
+    sums[no].valid = true;
+    sums[no].dive = dive;
+    sums[no].fingerprint = fingerprint;
+}
+
+unsigned int
+DiveChecksums::size()
+{
+    unsigned int count(0);
+
+    load();
+    for (unsigned int i = 0; i < sums.size(); i++)
+	if (sums[i].valid)
+	    count++;
+
+    return count;
+}
+
+void
+DiveChecksums::load()
+{
+    if (loaded)
+	return;
+
+    bfs::ifstream fin(path);
+    string line;
+
+    while (getline(fin, line)) {
+	int no;
+	unsigned int dive, fp;
+	char trailing;
+
+	if (sscanf(line.c_str(), "%d %8x %8x %c",
+		   &no, &dive, &fp, &trailing) != 3 || no < 0)
+	    continue;
+
+	if ((unsigned int)no >= sums.size())
+	    sums.resize(no + 1);
+	sums[no].valid = true;
+	sums[no].dive = dive;
+	sums[no].fingerprint = fp;
+    }
+
+    loaded = true;
+}
+
+
+enum ScrubStatus {
+    SCRUB_OK,
+    SCRUB_UNCHECKED,
+    SCRUB_MISSING,
+    SCRUB_UNREADABLE,
+    SCRUB_CORRUPT,
+};
+
+struct ScrubDive {
+    ScrubStatus status;
+    uint32_t dive;
+    uint32_t fingerprint;
+    uint64_t bytes;
+};
+
+struct ScrubJob {
+    DirDiveStore *store;
+    const vector<DiveChecksum> *sums;
+    vector<ScrubDive> *dives;
+
+    /** Next dive to check, shared by all threads */
+    volatile unsigned int next;
+};
+
+/**
+ * Checksum a file
+ *
+ * @return SCRUB_OK, SCRUB_MISSING if the file doesn't exist or
+ *         SCRUB_UNREADABLE if it can't be read, crc is only set on
+ *         success
+ */
+static ScrubStatus
+checksumFile(const bfs::path &path, uint32_t &crc, uint64_t &bytes)
+{
+    MappedFile file;
+    ScrubStatus status(SCRUB_OK);
+
+    const int fd(open(path.string().c_str(), O_RDONLY));
+    if (fd == -1)
+	return errno == ENOENT ? SCRUB_MISSING : SCRUB_UNREADABLE;
+
+    try {
+	file.open(fd, path.string());
+	crc = crc32c(0, file.data(), file.size());
+	bytes += file.size();
+    } catch (DiveStoreException e) {
+	status = SCRUB_UNREADABLE;
+    }
+    close(fd);
+
+    return status;
+}
+
+static void
+scrubDive(ScrubJob &job, unsigned int no)
+{
+    const DiveChecksum &sum((*job.sums)[no]);
+    ScrubDive &dive((*job.dives)[no]);
+
+    dive.bytes = 0;
+    ScrubStatus status(checksumFile(job.store->divePath(no), dive.dive,
+				    dive.bytes));
+    if (status == SCRUB_OK)
+	status = checksumFile(job.store->fingerprintPath(no),
+			      dive.fingerprint, dive.bytes);
+
+    // Unreadable files have no checksum and are never recorded
+    if (status != SCRUB_OK)
+	dive.status = status;
+    else if (!sum.valid)
+	dive.status = SCRUB_UNCHECKED;
+    else if (sum.dive != dive.dive || sum.fingerprint != dive.fingerprint)
+	dive.status = SCRUB_CORRUPT;
+    else
+	dive.status = SCRUB_OK;
+}
+
+static void *
+scrubThread(void *arg)
+{
+    ScrubJob &job(*static_cast<ScrubJob *>(arg));
+    unsigned int no;
+
+    while ((no = __sync_fetch_and_add(&job.next, 1)) < job.dives->size())
+	scrubDive(job, no);
+
+    return NULL;
+}
+
+void
+scrubDirStore(DirDiveStore &store, unsigned int threads, bool update,
+	      ScrubResult &result)
+{
+    DiveChecksums &checksums(store.getChecksums());
+    const int last(store.findNewestDive());
+    vector<DiveChecksum> sums(last + 1);
+    vector<ScrubDive> dives(last + 1);
+    vector<pthread_t> workers;
+    ScrubJob job;
+
+    // Look up the checksums up front, the workers only read them
+    for (int i = 0; i <= last; i++)
+	sums[i] = checksums.get(i);
+
+    job.store = &store;
+    job.sums = &sums;
+    job.dives = &dives;
+    job.next = 0;
+
+    for (unsigned int i = 1; i < threads && i < dives.size(); i++) {
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, scrubThread, &job))
+	    break;
+	workers.push_back(thread);
+    }
+
+    // The calling thread helps out, which also guarantees progress
+    // if no threads could be created.
+    scrubThread(&job);
+
+    for (unsigned int i = 0; i < workers.size(); i++)
+	pthread_join(workers[i], NULL);
+
+    for (int i = 0; i <= last; i++) {
+	const ScrubDive &dive(dives[i]);
+
+	result.bytes += dive.bytes;
+	switch (dive.status) {
+	case SCRUB_OK:
+	    result.checked++;
+	    break;
+
+	case SCRUB_UNCHECKED:
+	    if (update) {
+		checksums.add(i, dive.dive, dive.fingerprint);
+		result.updated++;
+	    } else
+		result.unchecked++;
+	    break;
+
+	case SCRUB_MISSING:
+	    result.missing.push_back(i);
+	    break;
+
+	case SCRUB_UNREADABLE:
+	    result.unreadable.push_back(i);
+	    break;
+
+	case SCRUB_CORRUPT:
+	    result.corrupt.push_back(i);
+	    break;
+	}
+    }
+}
@@ -0,0 +1,835 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dive_store.hh"
+#include "dive_archive.hh"
+#include "dive_cas.hh"
+#include "dive_compress.hh"
+#include "crc32c.hh"
+#include "dcconf.hh"
+
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/foreach.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/program_options.hpp>
+
+#define DIVE_BASE "dive_"
+
+namespace bfs = boost::filesystem;
+namespace po = boost::program_options;
+
+using namespace std;
+
+static void
+throwErrno(const string &what, const bfs::path &path)
+{
+    stringstream ss;
+    ss << what << " '" << path.string() << "': " << strerror(errno);
+    throw DiveStoreException(ss.str());
+}
+
+DiveStoreException::DiveStoreException(const string &_msg)
+    : msg(_msg)
+{
+}
+
+const char *
+DiveStoreException::what() const throw()
+{
+    return msg.c_str();
+}
+
+static bfs::path
+tmpPath(const bfs::path &path)
+{
+    static unsigned int tmpCount = 0;
+    stringstream tmpName;
+
+    // Use a unique temporary name, several writers may be storing
+    // the same file concurrently.
+    tmpName << path.string() << ".tmp." << getpid()
+	    << "." << __sync_fetch_and_add(&tmpCount, 1);
+    return bfs::path(tmpName.str());
+}
+
+void
+writeFileAtomic(const bfs::path &path, const void *data, unsigned int size)
+{
+    const char *p = (const char *)data;
+    const bfs::path tmp(tmpPath(path));
+    int fd;
+
+    fd = open(tmp.string().c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd == -1)
+	throwErrno("Failed to create", tmp);
+
+    while (size > 0) {
+	ssize_t ret = write(fd, p, size);
+	if (ret == -1) {
+	    if (errno == EINTR)
+		continue;
+	    close(fd);
+	    throwErrno("Failed to write", tmp);
+	}
+	p += ret;
+	size -= ret;
+    }
+
+    if (fsync(fd) == -1) {
+	close(fd);
+	throwErrno("Failed to sync", tmp);
+    }
+
+    if (close(fd) == -1)
+	throwErrno("Failed to close", tmp);
+
+    if (rename(tmp.string().c_str(), path.string().c_str()) == -1)
+	throwErrno("Failed to rename", tmp);
+}
+
+void
+writeFilesAtomic(IoBatch &batch, const AtomicFile *files, unsigned int count)
+{
+    vector<bfs::path> tmps;
+    vector<int> fds;
+
+    try {
+	for (unsigned int i = 0; i < count; i++) {
+	    tmps.push_back(tmpPath(files[i].path));
+
+	    const int fd(open(tmps[i].string().c_str(),
+			      O_WRONLY | O_CREAT | O_EXCL, 0666));
+	    if (fd == -1)
+		throwErrno("Failed to create", tmps[i]);
+	    fds.push_back(fd);
+
+	    batch.write(fd, files[i].data, files[i].size, 0,
+			tmps[i].string());
+	    batch.sync(fd, false, tmps[i].string());
+	}
+
+	batch.submit();
+
+	while (!fds.empty()) {
+	    const int fd(fds.back());
+	    fds.pop_back();
+	    if (close(fd) == -1)
+		throwErrno("Failed to close", tmps[fds.size()]);
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+	    if (rename(tmps[i].string().c_str(),
+		       files[i].path.string().c_str()) == -1)
+		throwErrno("Failed to rename", tmps[i]);
+	}
+    } catch (...) {
+	BOOST_FOREACH(int fd, fds)
+	    close(fd);
+	BOOST_FOREACH(const bfs::path &tmp, tmps)
+	    unlink(tmp.string().c_str());
+	throw;
+    }
+}
+
+void
+readFile(const bfs::path &path, vector<char> &data)
+{
+    bfs::ifstream fin(path, ios::in | ios::binary);
+    int length;
+
+    if (!fin)
+	throwErrno("Failed to open", path);
+
+    fin.seekg(0, ios::end);
+    length = fin.tellg();
+    fin.seekg(0, ios::beg);
+
+    data.resize(length);
+    if (length)
+	fin.read(&data[0], length);
+
+    if (!fin)
+	throwErrno("Failed to read", path);
+}
+
+MappedFile::MappedFile()
+    : map(NULL), mapSize(0), base(NULL), length(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void
+MappedFile::open(const bfs::path &path)
+{
+    int fd;
+
+    close();
+
+    fd = ::open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+	throwErrno("Failed to open", path);
+
+    try {
+	open(fd, path.string());
+    } catch (...) {
+	::close(fd);
+	throw;
+    }
+
+    ::close(fd);
+}
+
+void
+MappedFile::open(int fd, const string &name)
+{
+    struct stat st;
+
+    close();
+
+    if (fstat(fd, &st) == -1)
+	throwErrno("Failed to stat", name);
+
+    // Empty files can't be mapped and anything that isn't a regular
+    // file may not support mmap, fall back to reading those.
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+	readAll(fd, name);
+	return;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+	map = NULL;
+	readAll(fd, name);
+	return;
+    }
+
+    // Parsers walk through the whole dive, so ask for it to be
+    // read ahead.
+    madvise(map, st.st_size, MADV_WILLNEED);
+
+    mapSize = st.st_size;
+    base = (const char *)map;
+    length = st.st_size;
+}
+
+void
+MappedFile::close()
+{
+    if (map)
+	munmap(map, mapSize);
+
+    map = NULL;
+    mapSize = 0;
+    buffer.clear();
+    base = NULL;
+    length = 0;
+}
+
+void
+MappedFile::readAll(int fd, const string &name)
+{
+    char buf[4096];
+    ssize_t ret;
+
+    while ((ret = read(fd, buf, sizeof(buf))) != 0) {
+	if (ret == -1) {
+	    if (errno == EINTR)
+		continue;
+	    throwErrno("Failed to read", name);
+	}
+	buffer.insert(buffer.end(), buf, buf + ret);
+    }
+
+    base = buffer.empty() ? NULL : &buffer[0];
+    length = buffer.size();
+}
+
+
+DiveStore::DiveStore()
+    : compress(false)
+{
+}
+
+DiveStore::~DiveStore()
+{
+}
+
+int
+DiveStore::moveDive(const bfs::path &data, const bfs::path &fp,
+		    const DiveChecksum &sum)
+{
+    vector<char> dive, fingerprint;
+    int no;
+
+    readFile(data, dive);
+    readFile(fp, fingerprint);
+
+    no = addDive(dive.empty() ? NULL : &dive[0], dive.size(),
+		 fingerprint.empty() ? NULL : &fingerprint[0],
+		 fingerprint.size());
+
+    bfs::remove(fp);
+    bfs::remove(data);
+
+    return no;
+}
+
+string
+DiveStore::storeData(const void *data, unsigned int size)
+{
+    return string();
+}
+
+int
+DiveStore::addDiveRef(const string &ref, const void *fp, unsigned int fsize)
+{
+    throw DiveStoreException("Dive references aren't supported by "
+			     "this storage format");
+}
+
+
+string
+toHex(const vector<char> &data)
+{
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+
+    BOOST_FOREACH(char c, data) {
+	hex += digits[(c >> 4) & 0xF];
+	hex += digits[c & 0xF];
+    }
+
+    return hex;
+}
+
+bool
+fromHex(const string &hex, vector<char> &data)
+{
+    data.clear();
+    if (hex.length() % 2)
+	return false;
+
+    for (unsigned int i = 0; i < hex.length(); i += 2) {
+	char byte[3] = { hex[i], hex[i + 1], '\0' };
+	char *endptr;
+	long v = strtol(byte, &endptr, 16);
+
+	if (endptr != byte + 2)
+	    return false;
+	data.push_back((char)v);
+    }
+
+    return true;
+}
+
+DirDiveStore::DirDiveStore(const bfs::path &_dir)
+    : dir(_dir), indexPath(_dir / ".divetools" / "index"),
+      lastDive(-1), lastDiveValid(false),
+      checksums(_dir / ".divetools" / "checksums")
+{
+}
+
+int
+DirDiveStore::getLastDive()
+{
+    if (!lastDiveValid)
+	loadIndex();
+
+    return lastDive;
+}
+
+void
+DirDiveStore::readDive(int no, vector<char> &data)
+{
+    readFile(divePath(no), data);
+    if (compress)
+	decompressDive(data);
+}
+
+void
+DirDiveStore::readFingerprint(int no, vector<char> &fp)
+{
+    if (no == getLastDive())
+	fp = lastFp;
+    else
+	readFile(fingerprintPath(no), fp);
+}
+
+int
+DirDiveStore::addDive(const void *data, unsigned int size,
+		      const void *fp, unsigned int fsize)
+{
+    const int no = getLastDive() + 1;
+    vector<char> cdata;
+
+    if (compress) {
+	compressDive(data, size, cdata);
+	data = &cdata[0];
+	size = cdata.size();
+    }
+
+    // Record the checksum before the dive can be seen. A crash before
+    // the dive is stored leaves a checksum that is overwritten when
+    // the number is used again.
+    checksums.add(no, crc32c(0, data, size), crc32c(0, fp, fsize));
+
+    lastDive = no;
+    lastFp.assign((const char *)fp, (const char *)fp + fsize);
+    const string index(formatIndex());
+
+    // The fingerprint file marks the dive as complete, so it has to
+    // be renamed after the dive. The index is written in the same
+    // batch to save a round of system calls.
+    const AtomicFile files[] = {
+	AtomicFile(divePath(no), data, size),
+	AtomicFile(fingerprintPath(no), fp, fsize),
+	AtomicFile(indexPath, index.c_str(), index.length()),
+    };
+    try {
+	writeFilesAtomic(batch, files, 3);
+    } catch (...) {
+	// Reload the index, the dive may be partially stored
+	lastDiveValid = false;
+	throw;
+    }
+
+    return no;
+}
+
+int
+DirDiveStore::moveDive(const bfs::path &data, const bfs::path &fp,
+		       const DiveChecksum &sum)
+{
+    // Dives have to be rewritten to compress them
+    if (compress)
+	return DiveStore::moveDive(data, fp, sum);
+
+    const int no = getLastDive() + 1;
+    vector<char> fingerprint;
+
+    readFile(fp, fingerprint);
+
+    if (sum.valid)
+	checksums.add(no, sum.dive, sum.fingerprint);
+    else {
+	// Spooled by a version that didn't record checksums
+	MappedFile dive;
+	dive.open(data);
+	checksums.add(no, crc32c(0, dive.data(), dive.size()),
+		      crc32c(0, fingerprint.empty() ? NULL : &fingerprint[0],
+			     fingerprint.size()));
+    }
+
+    bfs::rename(data, divePath(no));
+    bfs::rename(fp, fingerprintPath(no));
+
+    lastDive = no;
+    lastFp.swap(fingerprint);
+    saveIndex();
+
+    return no;
+}
+
+void
+DirDiveStore::rebuildIndex()
+{
+    lastDive = findLastDive();
+    if (lastDive >= 0)
+	readFile(fingerprintPath(lastDive), lastFp);
+    else
+	lastFp.clear();
+    lastDiveValid = true;
+
+    if (bfs::exists(indexPath.parent_path()))
+	saveIndex();
+}
+
+int
+DirDiveStore::findNewestDive()
+{
+    int last(findLastDive());
+    int indexed;
+    vector<char> fp;
+
+    if (readIndex(indexed, fp) && indexed > last)
+	last = indexed;
+
+    return last;
+}
+
+/**
+ * Parse the index without checking it against the stored dives
+ *
+ * @return false if there is no index
+ */
+bool
+DirDiveStore::readIndex(int &last, vector<char> &fp)
+{
+    if (!bfs::exists(indexPath))
+	return false;
+
+    po::options_description desc;
+    desc.add_options()
+	("index.last", po::value<int>())
+	("index.fingerprint", po::value<string>())
+	;
+
+    bfs::ifstream fin(indexPath);
+    po::variables_map vm;
+    try {
+	po::store(po::parse_config_file(fin, desc), vm);
+	po::notify(vm);
+    } catch (po::error e) {
+	throw DiveStoreException("Invalid dive index: " + string(e.what()));
+    }
+
+    if (!vm.count("index.last") ||
+	!fromHex(vm.count("index.fingerprint") ?
+		 vm["index.fingerprint"].as<string>() : "", fp))
+	throw DiveStoreException("Invalid dive index");
+
+    last = vm["index.last"].as<int>();
+    return true;
+}
+
+void
+DirDiveStore::loadIndex()
+{
+    if (!readIndex(lastDive, lastFp)) {
+	// Logbooks created before the index was introduced
+	rebuildIndex();
+	return;
+    }
+
+    lastDiveValid = true;
+
+    if (lastDive >= 0 && !bfs::exists(fingerprintPath(lastDive)))
+	throw DiveStoreException(
+	    "Dive index doesn't match the stored dives, "
+	    "use --rebuild-index to recreate it");
+
+    // A session that was interrupted after storing a dive but before
+    // updating the index leaves the index slightly behind.
+    if (bfs::exists(fingerprintPath(lastDive + 1))) {
+	while (bfs::exists(fingerprintPath(lastDive + 1)))
+	    lastDive++;
+	readFile(fingerprintPath(lastDive), lastFp);
+	saveIndex();
+    }
+}
+
+void
+DirDiveStore::saveIndex()
+{
+    const string index(formatIndex());
+    writeFileAtomic(indexPath, index.c_str(), index.length());
+}
+
+string
+DirDiveStore::formatIndex() const
+{
+    stringstream ss;
+
+    ss << "[index]" << endl
+       << "last = " << lastDive << endl
+       << "fingerprint = " << toHex(lastFp) << endl;
+
+    return ss.str();
+}
+
+bfs::path
+DirDiveStore::divePath(int no) const
+{
+    stringstream name;
+    // Compression is set when the logbook is created, so all dives of
+    // a logbook share the same extension.
+    name << DIVE_BASE << no << (compress ? DIVE_COMPRESSED_EXT : ".raw");
+    return dir / name.str();
+}
+
+bfs::path
+DirDiveStore::fingerprintPath(int no) const
+{
+    stringstream name;
+    name << DIVE_BASE << no << ".fp";
+    return dir / name.str();
+}
+
+int
+DirDiveStore::findLastDive()
+{
+    int last = -1;
+
+    if (!bfs::exists(dir))
+	return last;
+
+    BOOST_FOREACH(bfs::path path,
+		  make_pair(bfs::directory_iterator(dir),
+			    bfs::directory_iterator())) {
+
+	string name(path.filename());
+
+	if (name.compare(0, sizeof(DIVE_BASE) - 1, DIVE_BASE) == 0 &&
+	    name.compare(name.length() - 3, 3, ".fp") == 0) {
+	    const char *cname = name.c_str();
+	    char *endptr;
+	    errno = 0;
+	    long no = strtol(cname + sizeof(DIVE_BASE) - 1, &endptr, 10);
+
+	    if (errno != 0 || endptr != cname + name.length() - 3)
+		throw DiveStoreException(
+		    "Invalid dive file in output directory (" + name + ")");
+
+	    if (no < 0 || no > 0x7FFFFFFF)
+		throw DiveStoreException(
+		    "Found dive file with out of range number (" + name + ")");
+
+	    if (no > last)
+		last = no;
+	}
+    }
+
+    return last;
+}
+
+
+DiveSpool::DiveSpool(const bfs::path &_dir, DiveStore &_store)
+    : dir(_dir), store(_store), isOpen(false), count(0), pos(0), reused(0)
+{
+}
+
+void
+DiveSpool::open()
+{
+    if (isOpen)
+	return;
+
+    bfs::create_directory(dir);
+
+    // Dives are written atomically, the spool is therefore valid up
+    // to the first dive that lacks a fingerprint.
+    count = 0;
+    while ((bfs::exists(divePath(count)) || bfs::exists(refPath(count))) &&
+	   bfs::exists(fingerprintPath(count)))
+	count++;
+    truncate(count);
+
+    isOpen = true;
+}
+
+void
+DiveSpool::addDive(const void *data, unsigned int size,
+		   const void *fp, unsigned int fsize)
+{
+    open();
+
+    if (pos < count) {
+	vector<char> spooledFp;
+	readFile(fingerprintPath(pos), spooledFp);
+
+	if (spooledFp.size() == fsize &&
+	    (fsize == 0 || memcmp(&spooledFp[0], fp, fsize) == 0)) {
+	    pos++;
+	    reused++;
+	    return;
+	}
+
+	// New dives have been added to the device since the spool was
+	// written, the rest of the spool is out of sync.
+	truncate(pos);
+    }
+
+    const string ref(store.storeData(data, size));
+    if (!ref.empty()) {
+	const string line(ref + "\n");
+	const AtomicFile files[] = {
+	    AtomicFile(refPath(pos), line.c_str(), line.length()),
+	    AtomicFile(fingerprintPath(pos), fp, fsize),
+	};
+	writeFilesAtomic(batch, files, 2);
+	count = ++pos;
+	return;
+    }
+
+    char sum[32];
+    const int len(snprintf(sum, sizeof(sum), "%08x %08x\n",
+			   crc32c(0, data, size), crc32c(0, fp, fsize)));
+
+    // The fingerprint marks the dive as complete and goes last
+    const AtomicFile files[] = {
+	AtomicFile(divePath(pos), data, size),
+	AtomicFile(checksumPath(pos), sum, len),
+	AtomicFile(fingerprintPath(pos), fp, fsize),
+    };
+    writeFilesAtomic(batch, files, 3);
+    count = ++pos;
+}
+
+void
+DiveSpool::commit()
+{
+    open();
+
+    // Anything beyond the current position wasn't seen in this
+    // download and is stale.
+    truncate(pos);
+
+    while (count > 0) {
+	--count;
+
+	if (bfs::exists(refPath(count))) {
+	    vector<char> fp;
+	    string ref;
+
+	    bfs::ifstream fin(refPath(count));
+	    getline(fin, ref);
+	    fin.close();
+
+	    readFile(fingerprintPath(count), fp);
+	    store.addDiveRef(ref, fp.empty() ? NULL : &fp[0], fp.size());
+	    bfs::remove(fingerprintPath(count));
+	    bfs::remove(refPath(count));
+	    continue;
+	}
+
+	DiveChecksum sum;
+	bfs::ifstream fin(checksumPath(count));
+	unsigned int dive, fp;
+	if (fin >> hex >> dive >> fp) {
+	    sum.valid = true;
+	    sum.dive = dive;
+	    sum.fingerprint = fp;
+	}
+	fin.close();
+
+	store.moveDive(divePath(count), fingerprintPath(count), sum);
+	bfs::remove(checksumPath(count));
+    }
+
+    pos = 0;
+}
+
+bfs::path
+DiveSpool::divePath(unsigned int no) const
+{
+    stringstream name;
+    name << no << ".raw";
+    return dir / name.str();
+}
+
+bfs::path
+DiveSpool::fingerprintPath(unsigned int no) const
+{
+    stringstream name;
+    name << no << ".fp";
+    return dir / name.str();
+}
+
+bfs::path
+DiveSpool::checksumPath(unsigned int no) const
+{
+    stringstream name;
+    name << no << ".sum";
+    return dir / name.str();
+}
+
+bfs::path
+DiveSpool::refPath(unsigned int no) const
+{
+    stringstream name;
+    name << no << ".ref";
+    return dir / name.str();
+}
+
+void
+DiveSpool::truncate(unsigned int no)
+{
+    BOOST_FOREACH(bfs::path path,
+		  make_pair(bfs::directory_iterator(dir),
+			    bfs::directory_iterator())) {
+
+	string name(path.filename());
+	const char *cname = name.c_str();
+	char *endptr;
+	errno = 0;
+	unsigned long i = strtoul(cname, &endptr, 10);
+
+	// Leftover temporary files and dives past the new end of the
+	// spool are removed.
+	if (errno != 0 || endptr == cname || i >= no ||
+	    (strcmp(endptr, ".raw") != 0 && strcmp(endptr, ".fp") != 0 &&
+	     strcmp(endptr, ".sum") != 0 && strcmp(endptr, ".ref") != 0))
+	    bfs::remove(path);
+    }
+
+    if (count > no)
+	count = no;
+}
+
+
+DiveStore *
+storeCreate(const DCConf &conf, const bfs::path &dir)
+{
+    const string &format(conf.storeFormat);
+
+    DiveStore *store;
+
+    if (format == "dir")
+	store = new DirDiveStore(dir);
+    else if (format == "archive")
+	store = new ArchiveDiveStore(dir);
+    else if (format == "cas") {
+	bfs::path objectDir(conf.storeObjects.empty() ?
+			    "objects" : conf.storeObjects);
+	if (!objectDir.is_complete())
+	    objectDir = dir / objectDir;
+
+	store = new CasDiveStore(dir, objectDir);
+    } else
+	return NULL;
+
+    store->setCompression(conf.storeCompress);
+    return store;
+}
@@ -35,7 +35,7 @@
 using namespace std;
 
 SerializeCSV::SerializeCSV(ostream &_out)
-    : SampleBuilder(),
+    : SampleBuilder<SerializeCSV>(),
       out(_out), separator(',')
 {
 }
@@ -36,7 +36,7 @@ using namespace std;
 using namespace dcxx;
 
 SerializeText::SerializeText(ostream &_out)
-    : ParserCallbacks(),
+    : SampleHandler<SerializeText>(),
       out(_out), separator(',')
 {
 }
@@ -100,8 +100,8 @@ namespace uddf {
 
     struct InformationAfterDive
     {
-	dcxx::Duration diveDuration;
-	dcxx::Length greatestDepth;
+	ValidValue<dcxx::Duration> diveDuration;
+	ValidValue<dcxx::Length> greatestDepth;
 	ValidValue<double> highestPO2;
 	ValidValue<dcxx::Temperature> lowestTemperature;
 
@@ -236,8 +236,11 @@ operator<<(xml::ContentHandler &out, const uddf::InformationAfterDive &info)
 {
     xml::ScopedElement e(out, "informationafterdive");
 
-    out.simpleTextElement("diveduration", info.diveDuration.seconds());
-    out.simpleTextElement("greatestdepth", info.greatestDepth.metre());
+    if (info.diveDuration)
+	out.simpleTextElement("diveduration", info.diveDuration.get().seconds());
+
+    if (info.greatestDepth)
+	out.simpleTextElement("greatestdepth", info.greatestDepth.get().metre());
 
     if (info.highestPO2)
 	out.simpleTextElement("highestpo2", info.highestPO2.get());
@@ -331,25 +334,30 @@ operator<<(xml::ContentHandler &out, const uddf::File &uddf)
 
 
 SerializeUDDF::SerializeUDDF(ostream &_out, dcxx::Parser &parser)
-    : SampleBuilder(),
+    : SampleBuilder<SerializeUDDF>(),
       out(_out)
 {
+    const dcxx::DiveHeader &header(parser.getHeader());
+    // The start time identifies the dive and can't be left out
+    if (!header.hasDateTime())
+	throw dcxx::ParserException(header.dateTimeStatus);
+
     uddf.reset(new uddf::File());
 
     uddf->profileData.repetitionGroups.push_back(
-	uddf::RepetitionGroup(repetitionGroupID(parser)));
+	uddf::RepetitionGroup(repetitionGroupID(header.dateTime)));
     currentRG = &uddf->profileData.repetitionGroups.front();
 
-    currentRG->dives.push_back(uddf::Dive(diveID(parser)));
+    currentRG->dives.push_back(uddf::Dive(diveID(header.dateTime)));
     currentDive = &currentRG->dives.front();
 
     uddf::InformationAfterDive &infoAfter(currentDive->infoAfter);
     uddf::InformationBeforeDive &infoBefore(currentDive->infoBefore);
-    infoAfter.greatestDepth = parser.getMaxDepth();
-    infoAfter.diveDuration = parser.getDiveTime();
-    infoBefore.datetime = parser.getDateTime();
-
-
+    if (header.hasMaxDepth())
+	infoAfter.greatestDepth = header.maxDepth;
+    if (header.hasDiveTime())
+	infoAfter.diveDuration = header.diveTime;
+    infoBefore.datetime = header.dateTime;
 }
 
 SerializeUDDF::~SerializeUDDF()
@@ -447,21 +455,19 @@ SerializeUDDF::onEvent(parser_sample_event_t type, dcxx::Duration time,
 }
 
 string
-SerializeUDDF::repetitionGroupID(dcxx::Parser &parser)
+SerializeUDDF::repetitionGroupID(time_t dateTime)
 {
     stringstream ss;
-    time_t time(parser.getDateTime());
-    ss << "rg-" << time;
+    ss << "rg-" << dateTime;
 
     return ss.str();
 }
 
 string
-SerializeUDDF::diveID(dcxx::Parser &parser)
+SerializeUDDF::diveID(time_t dateTime)
 {
     stringstream ss;
-    time_t time(parser.getDateTime());
-    ss << "dive-" << time;
+    ss << "dive-" << dateTime;
 
     return ss.str();
 }
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "spool_writer.hh"
+
+#include <exception>
+
+using namespace std;
+
+SpoolWriter::SpoolWriter(DiveSpool &_spool, unsigned int capacity)
+    : spool(_spool), ring(capacity), running(false),
+      done(false), failed(false), error(), ringFull(0)
+{
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&wakeup, NULL);
+
+    if (pthread_create(&thread, NULL, threadMain, this)) {
+	pthread_cond_destroy(&wakeup);
+	pthread_mutex_destroy(&lock);
+	throw DiveStoreException("Failed to start spool writer");
+    }
+
+    running = true;
+}
+
+SpoolWriter::~SpoolWriter()
+{
+    stop();
+
+    pthread_cond_destroy(&wakeup);
+    pthread_mutex_destroy(&lock);
+}
+
+void
+SpoolWriter::addDive(const void *data, unsigned int size,
+		     const void *fp, unsigned int fsize)
+{
+    Item *item(ring.back());
+
+    if (!item) {
+	ringFull++;
+	pthread_mutex_lock(&lock);
+	while (!(item = ring.back()) && !failed)
+	    pthread_cond_wait(&wakeup, &lock);
+	pthread_mutex_unlock(&lock);
+    }
+
+    if (failed) {
+	__sync_synchronize();
+	throw DiveStoreException(error);
+    }
+
+    item->data.assign((const char *)data, (const char *)data + size);
+    item->fp.assign((const char *)fp, (const char *)fp + fsize);
+    ring.push();
+    wake();
+}
+
+void
+SpoolWriter::finish()
+{
+    stop();
+
+    if (failed)
+	throw DiveStoreException(error);
+}
+
+void
+SpoolWriter::stop()
+{
+    if (!running)
+	return;
+
+    __sync_synchronize();
+    done = true;
+    wake();
+
+    pthread_join(thread, NULL);
+    running = false;
+}
+
+void *
+SpoolWriter::threadMain(void *arg)
+{
+    static_cast<SpoolWriter *>(arg)->run();
+    return NULL;
+}
+
+void
+SpoolWriter::run()
+{
+    while (true) {
+	// Check for completion before looking at the ring, the
+	// producer may have queued a dive just before setting done.
+	const bool last(done);
+	__sync_synchronize();
+	Item *item(ring.front());
+
+	if (!item) {
+	    if (last)
+		return;
+
+	    pthread_mutex_lock(&lock);
+	    while (!ring.front() && !done)
+		pthread_cond_wait(&wakeup, &lock);
+	    pthread_mutex_unlock(&lock);
+	    continue;
+	}
+
+	try {
+	    spool.addDive(item->data.empty() ? NULL : &item->data[0],
+			  item->data.size(),
+			  item->fp.empty() ? NULL : &item->fp[0],
+			  item->fp.size());
+	} catch (DiveStoreException e) {
+	    error = e.what();
+	} catch (std::exception &e) {
+	    error = e.what();
+	}
+
+	if (!error.empty()) {
+	    __sync_synchronize();
+	    failed = true;
+	    wake();
+	    return;
+	}
+
+	ring.pop();
+	wake();
+    }
+}
+
+void
+SpoolWriter::wake()
+{
+    // Taking the lock orders the wakeup after a waiter has checked
+    // the ring, so it can't be missed.
+    pthread_mutex_lock(&lock);
+    pthread_cond_broadcast(&wakeup);
+    pthread_mutex_unlock(&lock);
+}
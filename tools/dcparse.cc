@@ -32,15 +32,19 @@
 #include <string>
 #include <list>
 
+#include <unistd.h>
+
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/scoped_ptr.hpp>
-#include <boost/scoped_array.hpp>
 #include <boost/foreach.hpp>
 
 #include "dev_common.hh"
 #include "dcconf.hh"
+#include "dive_store.hh"
+#include "dive_compress.hh"
+#include "batch_io.hh"
 #include "serialize/csv.hh"
 #include "serialize/text.hh"
 #include "serialize/uddf.hh"
@@ -60,7 +64,9 @@ enum OutputFormat {
 DCConf dcconf;
 
 bool optForce = false;
+bool optIoStats = false;
 OutputFormat optFormat = FMT_TEXT;
+int optDive = -1;
 
 bfs::path diveFile;
 bfs::path projectDir;
@@ -99,6 +105,9 @@ parse_args(int argc, char **argv)
 	("help", "produce help message")
 	("force", "don't treat some errors as fatal")
 	("format", po::value<string>(), "output format ('help' to list formats)")
+	("dive", po::value<int>(),
+	 "read dive number N from the logbook directory DIR")
+	("io-stats", "print the number of system calls used for output")
 	;
 
     po::options_description optsHidden("Hidden");
@@ -123,6 +132,8 @@ parse_args(int argc, char **argv)
 
 	if (vm.count("help")) {
 	    cout << "Usage: dcparse [OPTION]... FILE" << endl;
+	    cout << "   or: dcparse [OPTION]... -" << endl;
+	    cout << "   or: dcparse [OPTION]... --dive N DIR" << endl;
 	    cout << optsVisible << endl;
 	    exit(EXIT_SUCCESS);
 	}
@@ -147,6 +158,8 @@ parse_args(int argc, char **argv)
 	    }
 	}
 
+	optIoStats = vm.count("io-stats") > 0;
+
 	if (vm.count("dive-file"))
 	    diveFile = vm["dive-file"].as<string>();
 	else {
@@ -156,7 +169,15 @@ parse_args(int argc, char **argv)
 
 	dcconf.handleArgs(vm);
 
-	projectDir = diveFile.parent_path();
+	if (vm.count("dive")) {
+	    optDive = vm["dive"].as<int>();
+	    if (optDive < 0) {
+		cerr << "Error: Invalid dive number" << endl;
+		exit(EXIT_FAILURE);
+	    }
+	    projectDir = diveFile;
+	} else
+	    projectDir = diveFile.parent_path();
 	configDir = projectDir / bfs::path(".divetools");
 	configFile = configDir / bfs::path("config");
     } catch (po::error e) {
@@ -166,74 +187,90 @@ parse_args(int argc, char **argv)
 }
 
 static void
-setFileData(Parser &parser, boost::scoped_array<char> &data)
+setFileData(Parser &parser, MappedFile &file, vector<char> &raw)
 {
-    bfs::ifstream fin(diveFile);
-    int length;
-
-    // Figure out the length of the fingerprint
-    fin.seekg (0, ios::end);
-    length = fin.tellg();
-    fin.seekg (0, ios::beg);
+    // The parser works directly on the mapped file, the data
+    // is only copied when reading from a pipe.
+    if (diveFile == "-")
+	file.open(STDIN_FILENO, "<stdin>");
+    else
+	file.open(diveFile);
+
+    // Dives from a compressed store are decompressed transparently
+    if (bfs::extension(diveFile) == DIVE_COMPRESSED_EXT) {
+	decompressDive(file.data(), file.size(), raw);
+	parser.setData(raw.empty() ? NULL : &raw[0], raw.size());
+    } else
+	parser.setData(file.data(), file.size());
+}
 
-    data.reset(new char[length]);
+static void
+setStoreData(Parser &parser, vector<char> &data)
+{
+    boost::scoped_ptr<DiveStore> store(
+	storeCreate(dcconf, projectDir));
+    if (!store.get()) {
+	cerr << "Error: Unknown storage format '"
+	     << dcconf.storeFormat << "'" << endl;
+	exit(EXIT_FAILURE);
+    }
 
-    fin.read(data.get(), length);
-    fin.close();
-    
-    parser.setData(data.get(), length);
+    store->readDive(optDive, data);
+    parser.setData(data.empty() ? NULL : &data[0], data.size());
 }
 
 static void
 outputText(Parser &parser)
 {
     SerializeText ser(cout);
-    Parser::GasMixVector mixes;
+    const DiveHeader &header(parser.getHeader());
 
-    parser.setCallbackHandler(&ser);
-    parser.getGasMixes(mixes);
-
-    cout << "Dive info:" << endl
-	 << "  Dive time: " << parser.getDiveTime() << endl
-	 << "  Max Depth: " << parser.getMaxDepth() << endl;
+    cout << "Dive info:" << endl;
+    if (header.hasDiveTime())
+	cout << "  Dive time: " << header.diveTime << endl;
+    if (header.hasMaxDepth())
+	cout << "  Max Depth: " << header.maxDepth << endl;
 
     cout << "Gas Mixes:" << endl;
 
-    BOOST_FOREACH(gasmix_t mix, mixes)
+    BOOST_FOREACH(gasmix_t mix, header.gasMixes)
 	cout << "  He: " << mix.helium * 100.0 << "%"
 	     << " O2: " << mix.oxygen * 100.0 << "%"
 	     << " N2: " << mix.nitrogen * 100.0 << "%" << endl;
 
-    parser.forEachSample();
+    parser.forEachSample(ser);
 }
 
 static void
 outputCSV(Parser &parser)
 {
     SerializeCSV csv(cout);
-    parser.setCallbackHandler(&csv);
-    parser.forEachSample();
+    parser.forEachSample(csv);
 }
 
-int
-main(int argc, char **argv)
-{
-    parse_args(argc, argv);
-    if (!bfs::exists(diveFile)) {
-	cerr << "Error: Input file does not exist" << endl;
-	return 1;
+/** Redirects a stream to another buffer for the lifetime of the object */
+class ScopedRdbuf {
+public:
+    ScopedRdbuf(ostream &_stream, streambuf *buf)
+	: stream(_stream), orig(_stream.rdbuf(buf)) {
     }
 
-    parse_conf();
-
-    if (!dcconf.devInfo) {
-	cerr << "Error: Unknown device type specified" << endl;
-	return 1;
+    ~ScopedRdbuf() {
+	stream.rdbuf(orig);
     }
 
+private:
+    ostream &stream;
+    streambuf *orig;
+};
+
+static int
+convert(BatchOutputBuf &out)
+{
     try {
 	boost::scoped_ptr<Parser> parser;
-	boost::scoped_array<char> data;
+	MappedFile file;
+	vector<char> data;
 
 	parser.reset(parserCreate(dcconf.devInfo->parser));
 	if (!parser.get()) {
@@ -241,7 +278,10 @@ main(int argc, char **argv)
 	    return 1;
 	}
 
-	setFileData(*parser, data);
+	if (optDive >= 0)
+	    setStoreData(*parser, data);
+	else
+	    setFileData(*parser, file, data);
 
 	switch(optFormat) {
 	case FMT_TEXT:
@@ -252,13 +292,56 @@ main(int argc, char **argv)
 	    break;
 	case FMT_UDDF: {
 	    SerializeUDDF ser(cout, *parser);
-	    parser->setCallbackHandler(&ser);
-	    parser->forEachSample();
+	    parser->forEachSample(ser);
 	} break;
 	}
+
+	out.flush();
+    } catch (ParserException e) {
+	cerr << "Error: " << e.what() << endl;
+	return 1;
     } catch (DeviceException e) {
 	cerr << "Error: " << e.what() << endl;
 	return 1;
+    } catch (DiveStoreException e) {
+	cerr << "Error: " << e.what() << endl;
+	return 1;
+    } catch (std::exception &e) {
+	cerr << "Error: " << e.what() << endl;
+	return 1;
     }
     return 0;
 }
+
+int
+main(int argc, char **argv)
+{
+    parse_args(argc, argv);
+    if (diveFile != "-" && !bfs::exists(diveFile)) {
+	cerr << "Error: Input file does not exist" << endl;
+	return 1;
+    }
+
+    parse_conf();
+
+    if (!dcconf.devInfo) {
+	cerr << "Error: Unknown device type specified" << endl;
+	return 1;
+    }
+
+    // Output is written in large batches, which saves a lot of
+    // system calls when converting many dives.
+    BatchOutputBuf out(STDOUT_FILENO, "<stdout>");
+    int ret;
+    {
+	ScopedRdbuf redirect(cout, &out);
+	ret = convert(out);
+    }
+
+    if (optIoStats)
+	cerr << "I/O operations: " << batchIoOperations() << endl
+	     << "System calls: " << batchIoSyscalls() << endl
+	     << "Saved: " << batchIoSaved() << endl;
+
+    return ret;
+}
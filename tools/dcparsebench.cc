@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Benchmark of the per-dive cost of setting up a parser, comparing a
+ * new parser for every dive with parsers reused from a ParserPool.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "dev_common.hh"
+#include "dcconf.hh"
+#include "dive_store.hh"
+
+using namespace std;
+using namespace dcxx;
+
+namespace po = boost::program_options;
+namespace bfs = boost::filesystem;
+
+DCConf dcconf;
+
+unsigned int optIterations = 100;
+unsigned int optRounds = 5;
+bool optHeader = false;
+
+bfs::path projectDir;
+bfs::path configDir;
+bfs::path configFile;
+
+typedef vector<vector<char> > DiveVector;
+
+static void
+parse_conf()
+{
+    if (!bfs::exists(configFile) ||
+	!bfs::is_regular_file(configFile))
+	return;
+
+    bfs::ifstream fin(configFile);
+
+    po::options_description cfg_all;
+    cfg_all.add(dcconf.cfgCommon);
+
+    try {
+	po::variables_map vm;
+	po::store(parse_config_file(fin, cfg_all), vm);
+	po::notify(vm);
+
+	dcconf.handleConf(vm);
+    } catch (po::error e) {
+	cerr << "Error: " << e.what() << endl;
+	exit(EXIT_FAILURE);
+    }
+}
+
+static void
+parse_args(int argc, char **argv)
+{
+    po::options_description optsGeneral("General options");
+    optsGeneral.add_options()
+	("help", "produce help message")
+	("iterations", po::value<unsigned int>(),
+	 "number of passes over the logbook (default 100)")
+	("rounds", po::value<unsigned int>(),
+	 "number of timed runs of each strategy, the best is reported "
+	 "(default 5)")
+	("header", "also decode the dive header")
+	;
+
+    po::options_description optsHidden("Hidden");
+    optsHidden.add_options()
+	("project-dir", po::value<string>(), "");
+
+    po::options_description optsVisible;
+    optsVisible.add(optsGeneral).add(dcconf.optsCommon);
+
+    po::options_description optsAll;
+    optsAll.add(optsVisible).add(optsHidden);
+
+    po::positional_options_description args;
+    args.add("project-dir", 1);
+
+    po::variables_map vm;
+
+    try {
+	po::store(po::command_line_parser(argc, argv).
+		  options(optsAll).positional(args).run(), vm);
+	po::notify(vm);
+
+	if (vm.count("help")) {
+	    cout << "Usage: dcparsebench [OPTION]... [DIR]" << endl;
+	    cout << optsVisible << endl;
+	    exit(EXIT_SUCCESS);
+	}
+
+	if (vm.count("iterations")) {
+	    optIterations = vm["iterations"].as<unsigned int>();
+	    if (!optIterations) {
+		cerr << "Error: Invalid number of iterations" << endl;
+		exit(EXIT_FAILURE);
+	    }
+	}
+
+	if (vm.count("rounds")) {
+	    optRounds = vm["rounds"].as<unsigned int>();
+	    if (!optRounds) {
+		cerr << "Error: Invalid number of rounds" << endl;
+		exit(EXIT_FAILURE);
+	    }
+	}
+
+	optHeader = vm.count("header") > 0;
+
+	if (vm.count("project-dir"))
+	    projectDir = vm["project-dir"].as<string>();
+	else
+	    projectDir = bfs::current_path();
+
+	configDir = projectDir / bfs::path(".divetools");
+	configFile = configDir / bfs::path("config");
+
+	parse_conf();
+	// Command line options override the logbook's configuration
+	dcconf.handleArgs(vm);
+    } catch (po::error e) {
+	cerr << "Error: " << e.what() << endl;
+	exit(EXIT_FAILURE);
+    }
+}
+
+static double
+now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+useParser(Parser &parser, const vector<char> &dive)
+{
+    parser.setData(dive.empty() ? NULL : &dive[0], dive.size());
+    if (optHeader)
+	parser.getHeader();
+}
+
+/** Create and destroy a parser for every dive */
+static double
+runCreate(parser_type_t type, const DiveVector &dives,
+	  unsigned int iterations)
+{
+    const double start(now());
+    for (unsigned int i = 0; i < iterations; i++) {
+	for (unsigned int j = 0; j < dives.size(); j++) {
+	    boost::scoped_ptr<Parser> parser(parserCreate(type));
+	    useParser(*parser, dives[j]);
+	}
+    }
+    return now() - start;
+}
+
+/** Rebind the calling thread's pooled parser to every dive */
+static double
+runPool(parser_type_t type, const DiveVector &dives,
+	unsigned int iterations)
+{
+    const double start(now());
+    for (unsigned int i = 0; i < iterations; i++) {
+	for (unsigned int j = 0; j < dives.size(); j++)
+	    useParser(*ParserPool::local().get(type), dives[j]);
+    }
+    return now() - start;
+}
+
+static void
+report(const char *name, double time, unsigned int count)
+{
+    cout << name << ": " << time << " s, "
+	 << time / count * 1e9 << " ns per dive" << endl;
+}
+
+int
+main(int argc, char **argv)
+{
+    parse_args(argc, argv);
+
+    if (!dcconf.devInfo) {
+	cerr << "Error: Unknown device type specified" << endl;
+	return 1;
+    }
+
+    const parser_type_t type(dcconf.devInfo->parser);
+    if (!ParserPool::local().get(type)) {
+	cerr << "Error: Device type unsupported" << endl;
+	return 1;
+    }
+
+    try {
+	boost::scoped_ptr<DiveStore> store(storeCreate(dcconf, projectDir));
+	if (!store.get()) {
+	    cerr << "Error: Unknown storage format '"
+		 << dcconf.storeFormat << "'" << endl;
+	    return 1;
+	}
+
+	DiveVector dives(store->getLastDive() + 1);
+	if (dives.empty()) {
+	    cerr << "Error: No dives in the logbook" << endl;
+	    return 1;
+	}
+	for (unsigned int i = 0; i < dives.size(); i++)
+	    store->readDive(i, dives[i]);
+
+	const unsigned int count(dives.size() * optIterations);
+	cerr << "Setting up parsers for " << dives.size() << " dives, "
+	     << optIterations << " times, best of " << optRounds
+	     << " rounds..." << endl;
+
+	// Untimed pass to fault in the dives, the parser code and the
+	// pooled parser before anything is measured
+	runCreate(type, dives, 1);
+	runPool(type, dives, 1);
+
+	// Alternate the order so that neither strategy always runs on
+	// a cold or a warm cache, and keep the best time of each.
+	double create(0), pool(0);
+	for (unsigned int i = 0; i < optRounds; i++) {
+	    double c, p;
+	    if (i % 2) {
+		p = runPool(type, dives, optIterations);
+		c = runCreate(type, dives, optIterations);
+	    } else {
+		c = runCreate(type, dives, optIterations);
+		p = runPool(type, dives, optIterations);
+	    }
+
+	    if (!i || c < create)
+		create = c;
+	    if (!i || p < pool)
+		pool = p;
+	}
+
+	report("Create per dive", create, count);
+	report("Parser pool", pool, count);
+	cout << "Speedup: " << create / pool << "x" << endl;
+    } catch (ParserException e) {
+	cerr << "Error: " << e.what() << endl;
+	return 1;
+    } catch (DiveStoreException e) {
+	cerr << "Error: " << e.what() << endl;
+	return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "dcconf.hh"
+#include "dive_store.hh"
+#include "dive_scrub.hh"
+#include "crc32c.hh"
+
+using namespace std;
+
+namespace po = boost::program_options;
+namespace bfs = boost::filesystem;
+
+DCConf dcconf;
+
+bool optUpdate = false;
+unsigned int optThreads = 0;
+
+bfs::path outputDir;
+bfs::path configDir;
+bfs::path configFile;
+
+static void
+parse_conf()
+{
+    if (!bfs::exists(configFile) ||
+	!bfs::is_regular_file(configFile))
+	return;
+
+    bfs::ifstream fin(configFile);
+
+    po::options_description cfg_all;
+    cfg_all.add(dcconf.cfgCommon);
+
+    try {
+	po::variables_map vm;
+	po::store(parse_config_file(fin, cfg_all), vm);
+	po::notify(vm);
+
+	dcconf.handleConf(vm);
+    } catch (po::error e) {
+	cerr << "Error: " << e.what() << endl;
+	exit(EXIT_FAILURE);
+    }
+}
+
+static void
+parse_args(int argc, char **argv)
+{
+    po::options_description optsGeneral("General options");
+    optsGeneral.add_options()
+	("help", "produce help message")
+	("threads", po::value<unsigned int>(),
+	 "number of threads to use (default: one per CPU)")
+	("update", "record checksums for dives that don't have one")
+	;
+
+    po::options_description optsHidden("Hidden");
+    optsHidden.add_options()
+	("output-dir", po::value<string>(), "");
+
+    po::options_description optsAll;
+    optsAll.add(optsGeneral).add(optsHidden);
+
+    po::positional_options_description args;
+    args.add("output-dir", 1);
+
+    po::variables_map vm;
+
+    try {
+	po::store(po::command_line_parser(argc, argv).
+		  options(optsAll).positional(args).run(), vm);
+	po::notify(vm);
+
+	if (vm.count("help")) {
+	    cout << "Usage: dcscrub [OPTION]... [DIR]" << endl;
+	    cout << optsGeneral << endl;
+	    exit(EXIT_SUCCESS);
+	}
+
+	optUpdate = vm.count("update") > 0;
+
+	if (vm.count("threads")) {
+	    optThreads = vm["threads"].as<unsigned int>();
+	    if (!optThreads) {
+		cerr << "Error: Invalid number of threads" << endl;
+		exit(EXIT_FAILURE);
+	    }
+	} else {
+	    const long cpus(sysconf(_SC_NPROCESSORS_ONLN));
+	    optThreads = cpus > 0 ? cpus : 1;
+	}
+
+	if (vm.count("output-dir"))
+	    outputDir = vm["output-dir"].as<string>();
+	else
+	    outputDir = bfs::current_path();
+
+	configDir = outputDir / bfs::path(".divetools");
+	configFile = configDir / bfs::path("config");
+    } catch (po::error e) {
+	cerr << "Error: " << e.what() << endl;
+	exit(EXIT_FAILURE);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    parse_args(argc, argv);
+    if (!bfs::exists(configDir)) {
+	cerr << "Error: Output directory does not exist" << endl;
+	return 1;
+    }
+
+    parse_conf();
+
+    try {
+	boost::scoped_ptr<DiveStore> store(storeCreate(dcconf, outputDir));
+	DirDiveStore *dirStore(dynamic_cast<DirDiveStore *>(store.get()));
+	if (!dirStore) {
+	    cerr << "Error: Only logbooks using the 'dir' storage format "
+		 << "can be scrubbed" << endl;
+	    return 1;
+	}
+
+	ScrubResult result;
+	cerr << "Scrubbing " << dirStore->findNewestDive() + 1 << " dives using "
+	     << optThreads << " threads"
+	     << (haveHardwareCrc32c() ? " and hardware CRC32C" : "")
+	     << "..." << endl;
+	scrubDirStore(*dirStore, optThreads, optUpdate, result);
+
+	for (unsigned int i = 0; i < result.missing.size(); i++)
+	    cout << "Missing: dive " << result.missing[i] << endl;
+	for (unsigned int i = 0; i < result.unreadable.size(); i++)
+	    cout << "Unreadable: dive " << result.unreadable[i] << endl;
+	for (unsigned int i = 0; i < result.corrupt.size(); i++)
+	    cout << "Corrupt: dive " << result.corrupt[i] << endl;
+
+	cerr << "Verified " << result.checked << " dives ("
+	     << result.bytes << " bytes), "
+	     << result.corrupt.size() << " corrupt, "
+	     << result.unreadable.size() << " unreadable, "
+	     << result.missing.size() << " missing." << endl;
+	if (result.updated)
+	    cerr << "Recorded checksums for " << result.updated
+		 << " dives." << endl;
+	if (result.unchecked)
+	    cerr << result.unchecked << " dives have no checksum, "
+		 << "use --update to record them." << endl;
+
+	return result.corrupt.empty() && result.unreadable.empty() &&
+	    result.missing.empty() ? 0 : 1;
+    } catch (DiveStoreException e) {
+	cerr << "Error: " << e.what() << endl;
+	return 1;
+    }
+}
@@ -29,21 +29,29 @@
  */
 
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <list>
+#include <vector>
+
+#include <pthread.h>
 
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/scoped_ptr.hpp>
-#include <boost/shared_array.hpp>
-#include <boost/scoped_array.hpp>
+
+#include "dcxx/suunto.hh"
+#include "dcxx/deadline.hh"
 
 #include "dev_common.hh"
 #include "dcconf.hh"
-
-#define DIVE_BASE "dive_"
+#include "dive_store.hh"
+#include "dive_cas.hh"
+#include "dive_compress.hh"
+#include "spool_writer.hh"
+#include "batch_io.hh"
 
 using namespace std;
 using namespace dcxx;
@@ -55,199 +63,640 @@ DCConf dcconf;
 
 bool optForce = false;
 bool optInit = false;
+bool optRebuildIndex = false;
+bool optTuneDelay = false;
+unsigned int optRetries = 3;
+unsigned int optTimeLimit = 0;
+unsigned int optDiveTimeLimit = 0;
+bool optStats = false;
+bfs::path optStatsFile;
 
 bfs::path outputDir;
-bfs::path configDir;
-bfs::path configFile;
+bfs::path fleetFile;
+
+static pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * A line of output
+ *
+ * Several devices may be synchronized concurrently, the line is
+ * therefore buffered and written in one go when the message is
+ * destroyed.
+ */
+class Message {
+public:
+    Message(const string &prefix) { ss << prefix; }
+    ~Message() {
+	pthread_mutex_lock(&outputLock);
+	cerr << ss.str() << endl;
+	pthread_mutex_unlock(&outputLock);
+    }
 
-int lastDiveNo = -1;
+    template<typename T>
+    Message &operator<<(const T &value) { ss << value; return *this; }
 
-static void setFingerprint(Device &dev);
+private:
+    ostringstream ss;
+};
 
-class RawDive
-{
+/**
+ * Synchronization of one device with one logbook directory
+ *
+ * Errors are recorded in the session instead of terminating the
+ * program, which allows a failing device to be ignored while other
+ * devices are being synchronized.
+ */
+class SyncSession {
 public:
-    RawDive(const void *_data, int _size,
-	    const void *_fingerprint, int _fsize)
-	: size(_size), fsize(_fsize) {
+    SyncSession(DCConf &conf, const bfs::path &dir, bool init);
 
-	data.reset(new char[size]);
-	fingerprint.reset(new char[fsize]);
+    /** Check the logbook and load its configuration */
+    bool prepare();
+    /** Download new dives from the device and store them */
+    bool sync();
 
-	memcpy(data.get(), _data, size);
-	memcpy(fingerprint.get(), _fingerprint, fsize);
-    }
+    /** Fail the session, any ongoing download is cancelled */
+    void fail(const string &msg);
+    bool failed() const { return !error.empty(); }
+    /** The session failed because it ran out of time */
+    bool isCancelled() const { return cancelled; }
+    const string &getError() const { return error; }
 
-    void writeDive(const bfs::path &path) const {
-	bfs::ofstream ofDive(path);
-	ofDive.write(data.get(), size);
-	ofDive.close();
-    }
+    /** Prefix for all messages from this session */
+    void setName(const string &name) { prefix = "[" + name + "] "; }
+    const string &getPrefix() const { return prefix; }
 
-    void writeFingerprint(const bfs::path &path) const {
-	bfs::ofstream ofFingerprint(path);
-	ofFingerprint.write(fingerprint.get(), fsize);
-	ofFingerprint.close();
-    }
+    unsigned int getNewDives() const { return newDives; }
 
-    boost::shared_array<char> data;
-    int size;
+    /** Transfer statistics of the device after sync() */
+    const TransferStats &getStats() const { return stats; }
+    /** Print and dump the statistics as requested on the command line */
+    void reportStats();
 
-    boost::shared_array<char> fingerprint;
-    int fsize;
-};
+    /** Write the configuration to the logbook */
+    void saveConf();
 
-typedef list<RawDive> RawDiveList;
+    DCConf &conf;
+    const bfs::path outputDir;
+    const bfs::path configDir;
+    const bfs::path configFile;
+    const bfs::path spoolDir;
+    const bool init;
+
+    /** Report download progress */
+    bool showProgress;
+
+    /** Time budget of sync() */
+    Deadline deadline;
+
+private:
+    bool loadConf();
+
+    /** Apply a stored or freshly tuned command delay */
+    void setupDelay(suunto::Vyper &vyper);
+
+    string prefix;
+    string error;
+    unsigned int newDives;
+    bool cancelled;
+
+    TransferStats stats;
+};
 
 class Callbacks
     : public DeviceCallbacks
 {
 public:
+    Callbacks(SyncSession &_session, DiveStore &_store)
+	: session(_session), conf(_session.conf), store(_store),
+	  spool(_session.spoolDir, _store), writer(spool),
+	  diveCount(0), lastProgress(-1) {}
+
     void onEventWaiting(Device &device) {
-	cerr << "Waiting..." << endl;
+	Message(session.getPrefix()) << "Waiting...";
     }
 
     void onEventProgress(Device &device, const device_progress_t &progress) {
-	//const double f = 100.0 * progress.current / progress.maximum;
-	//cerr << "Progress: " << f << "%" << endl;
+	if (!session.showProgress || !progress.maximum)
+	    return;
+
+	// Only report every 10% to keep the output of several
+	// devices readable.
+	const int f = 100 * progress.current / progress.maximum / 10 * 10;
+	if (f != lastProgress) {
+	    lastProgress = f;
+	    Message(session.getPrefix()) << "Progress: " << f << "%";
+	}
     }
 
     void onEventDevInfo(Device &device, const device_devinfo_t &info) {
-	if (dcconf.devSerialValid && dcconf.devSerial != info.serial) {
-	    cerr << "Error: Serial number mismatch" << endl;
-	    exit(EXIT_FAILURE);
+	if (conf.devSerialValid && conf.devSerial != info.serial) {
+	    session.fail("Serial number mismatch");
+	    return;
 	}
 
-	if (lastDiveNo >= 0) {
-	    cerr << "Found previous dives, skipping the first " << lastDiveNo << " dives." << endl;
-	    setFingerprint(device);
-	}
+	// Don't let exceptions propagate through libdivecomputer
+	try {
+	    if (!session.init && store.getLastDive() >= 0) {
+		Message(session.getPrefix())
+		    << "Found previous dives, skipping the first "
+		    << store.getLastDive() + 1 << " dives.";
+		setFingerprint(device);
+	    }
 
-	if (optInit) {
-	    dcconf.setDevSerial(info.serial);
+	    if (session.init) {
+		conf.setDevSerial(info.serial);
 
-	    cerr << "Creating output directory structure..." << endl;
-	    bfs::create_directory(outputDir);
-	    bfs::create_directory(configDir);
+		Message(session.getPrefix())
+		    << "Creating output directory structure...";
+		bfs::create_directory(session.outputDir);
+		bfs::create_directory(session.configDir);
 
-	    cerr << "Storing configuration..." << endl;
-	    bfs::ofstream conf(configFile);
-	    conf << dcconf << endl;
-	    conf.close();
+		Message(session.getPrefix()) << "Storing configuration...";
+		session.saveConf();
+	    }
+	} catch (DeviceException e) {
+	    session.fail(e.what());
+	} catch (DiveStoreException e) {
+	    session.fail(e.what());
+	} catch (std::exception &e) {
+	    session.fail(e.what());
 	}
     }
 
     void onEventClock(Device &device, const device_clock_t &clock) {
-	cerr << "Error: Unhandled clock event, this device isn't supported." << endl;
-	exit(EXIT_FAILURE);
+	session.fail("Unhandled clock event, this device isn't supported.");
+    }
+
+    void onRetry(Device &device, const DeviceException &error,
+		 unsigned int attempt, unsigned int delay) {
+	Message(session.getPrefix())
+	    << error.what() << ", retrying in " << delay << " ms ("
+	    << attempt << "/" << device.getRetryPolicy().retries << ")...";
+    }
+
+    bool onCancel(Device &device) {
+	return session.failed() || session.deadline.expired();
     }
 
     bool onDive(Device &device,
 		const void *data, int size,
 		const void *fingerprint, int fsize) {
-	cerr << "Reading dive " << dives.size() << endl;
-	RawDive dive(data, size, fingerprint, fsize);
-	dives.push_front(dive);
+	if (session.failed())
+	    return false;
+
+	Message(session.getPrefix()) << "Reading dive " << diveCount++;
+	session.deadline.progress();
+
+	// Don't let exceptions propagate through libdivecomputer, dives
+	// that have already been spooled are picked up by the next
+	// session. The dive is written by the spool writer thread to
+	// keep file system stalls from delaying the device.
+	try {
+	    writer.addDive(data, size, fingerprint, fsize);
+	} catch (DiveStoreException e) {
+	    session.fail(e.what());
+	    return false;
+	}
 
 	return true;
     }
 
     void saveDives() {
-	BOOST_FOREACH(const RawDive &dive, dives) {
-	    stringstream diveName;
-	    stringstream fpName;
-	    int diveNo = ++lastDiveNo;
-
-	    diveName << DIVE_BASE << diveNo << ".raw";
-	    fpName << DIVE_BASE << diveNo << ".fp";
-
-	    dive.writeDive(outputDir / diveName.str());
-	    dive.writeFingerprint(outputDir / fpName.str());
-	}
+	writer.finish();
+	if (writer.getRingFull())
+	    Message(session.getPrefix())
+		<< "The spool writer fell behind " << writer.getRingFull()
+		<< " times.";
+
+	if (spool.getReused())
+	    Message(session.getPrefix())
+		<< "Reused " << spool.getReused()
+		<< " dives from an interrupted download.";
+
+	spool.commit();
+
+	CasDiveStore *cas(dynamic_cast<CasDiveStore *>(&store));
+	if (cas && cas->getDeduplicated())
+	    Message(session.getPrefix())
+		<< cas->getDeduplicated()
+		<< " dives were already in the object store.";
     }
 
-private:
-    static void setFingerprint(Device &dev) {
-	stringstream fpFName;
-	fpFName << DIVE_BASE << lastDiveNo << ".fp";
-	bfs::ifstream fin(outputDir / fpFName.str());
-	int length;
-
-	// Figure out the length of the fingerprint
-	fin.seekg (0, ios::end);
-	length = fin.tellg();
-	fin.seekg (0, ios::beg);
+    /**
+     * Keep the dives received so far in the spool. They can't be
+     * stored without the older dives, but are picked up by the next
+     * session.
+     */
+    void keepDives() {
+	writer.finish();
+	Message(session.getPrefix())
+	    << "Keeping " << spool.size()
+	    << " downloaded dives for the next session.";
+    }
 
-	boost::scoped_array<char> data;
-	data.reset(new char[length]);
+    unsigned int getDiveCount() const { return diveCount; }
 
-	fin.read(data.get(), length);
-	fin.close();
+private:
+    void setFingerprint(Device &dev) {
+	vector<char> fp;
+	store.readFingerprint(store.getLastDive(), fp);
 
-	dev.setFingerprint(data.get(), length);
+	dev.setFingerprint(fp.empty() ? NULL : &fp[0], fp.size());
     }
 
-    RawDiveList dives;
+    SyncSession &session;
+    DCConf &conf;
+    DiveStore &store;
+    DiveSpool spool;
+    SpoolWriter writer;
+    unsigned int diveCount;
+    int lastProgress;
 };
 
-static int
-findLastDive()
+SyncSession::SyncSession(DCConf &_conf, const bfs::path &dir, bool _init)
+    : conf(_conf), outputDir(dir),
+      configDir(dir / bfs::path(".divetools")),
+      configFile(configDir / bfs::path("config")),
+      spoolDir(configDir / bfs::path("spool")),
+      init(_init), showProgress(false),
+      deadline(), prefix(), error(), newDives(0), cancelled(false),
+      stats()
 {
-    BOOST_FOREACH(bfs::path path,
-		  make_pair(bfs::directory_iterator(outputDir),
-			    bfs::directory_iterator())) {
-
-	string name(path.filename());
-
-	if (name.compare(0, sizeof(DIVE_BASE) - 1, DIVE_BASE) == 0 &&
-	    name.compare(name.length() - 3, 3, ".fp") == 0) {
-	    const char *cname = name.c_str();
-	    char *endptr;
-	    errno = 0;
-	    long no = strtol(cname + sizeof(DIVE_BASE) - 1, &endptr, 10);
-
-	    if (errno != 0 || endptr != cname + name.length() - 3) {
-		cerr << "Error: Invalid dive file in output directory ("
-		     << name << ")" << endl;
-		exit(EXIT_FAILURE);
-	    }
-
-	    if (no < 0 || no > 0x8FFFFFFF) {
-		cerr << "Error: Found dive file with out of range number ("
-		     << name << ")" << endl;
-		exit(EXIT_FAILURE);
-	    }
+}
 
-	    if (no > lastDiveNo)
-		lastDiveNo = no;
-	}
-    }
+void
+SyncSession::fail(const string &msg)
+{
+    // Keep the first error, it's usually the interesting one
+    if (error.empty())
+	error = msg;
 }
 
-static void
-parse_conf()
+bool
+SyncSession::loadConf()
 {
     if (!bfs::exists(configFile) ||
 	!bfs::is_regular_file(configFile))
-	return;
+	return true;
 
     bfs::ifstream fin(configFile);
 
     po::options_description cfg_all;
-    cfg_all.add(dcconf.cfgCommon);
+    cfg_all.add(conf.cfgCommon);
 
     try {
 	po::variables_map vm;
 	po::store(parse_config_file(fin, cfg_all), vm);
 	po::notify(vm);
 
-	dcconf.handleConf(vm);
+	conf.handleConf(vm);
     } catch (po::error e) {
-	cerr << "Error: " << e.what() << endl;
+	fail(e.what());
+	return false;
+    }
+
+    return true;
+}
+
+void
+SyncSession::reportStats()
+{
+    if (optStats)
+	stats.print(cerr, conf.devInfo ? conf.devInfo->name : "unknown");
+
+    if (!optStatsFile.empty()) {
+	bfs::ofstream out(optStatsFile, ios::out | ios::app);
+	stats.dump(out, conf.devInfo ? conf.devInfo->name : "unknown");
+	if (!out)
+	    cerr << "Error: Failed to write statistics to "
+		 << optStatsFile << endl;
+    }
+}
+
+void
+SyncSession::saveConf()
+{
+    ostringstream out;
+    out << conf << endl;
+
+    const string str(out.str());
+    writeFileAtomic(configFile, str.c_str(), str.length());
+}
+
+void
+SyncSession::setupDelay(suunto::Vyper &vyper)
+{
+    if (!optTuneDelay && !conf.devDelayValid)
+	return;
+
+    // Same number as [device] serial, which comes from the DEVINFO event
+    const unsigned int serial(vyper.getDevInfoSerial());
+    const bool stored(conf.devDelayValid && conf.devDelaySerial == serial);
+
+    if (!optTuneDelay) {
+	if (stored) {
+	    vyper.setDelay(conf.devDelay);
+	    Message(prefix)
+		<< "Using a delay of " << conf.devDelay << " ms.";
+	}
+	return;
+    }
+
+    Message(prefix) << "Tuning the delay between commands...";
+    const unsigned int delay(
+	vyper.tuneDelay(stored ? conf.devDelay : suunto::Vyper::DEFAULT_DELAY));
+    Message(prefix) << "Using a delay of " << delay << " ms.";
+
+    // A new logbook gets its configuration once the device has
+    // identified itself.
+    conf.setDevDelay(serial, delay);
+    if (!init)
+	saveConf();
+}
+
+bool
+SyncSession::prepare()
+{
+    if (init) {
+	if (bfs::exists(outputDir)) {
+	    fail("Output directory already exists");
+	    return false;
+	}
+    } else {
+	if (!bfs::exists(outputDir) || !bfs::exists(configDir)) {
+	    fail("Output directory does not exist");
+	    return false;
+	}
+    }
+
+    if (!loadConf())
+	return false;
+
+    if (!conf.devInfo) {
+	fail("Unknown device type specified");
+	return false;
+    }
+
+    if (conf.devPort.empty()) {
+	fail("No port specified for device");
+	return false;
+    }
+
+    if (!init && !conf.devSerialValid) {
+	if(!optForce) {
+	    fail("No serial number specified in configuration.\n"
+		 "Use --force to ignore this error.");
+	    return false;
+	} else {
+	    Message(prefix)
+		<< "Warning: No serial number specified in configuration.";
+	    Message(prefix) << "Warning: Continuing anyway... Good luck!";
+	}
+    }
+
+    return true;
+}
+
+bool
+SyncSession::sync()
+{
+    deadline.setTotal(optTimeLimit);
+    deadline.setPerDive(optDiveTimeLimit);
+    deadline.start();
+
+    boost::scoped_ptr<Device> device;
+    boost::scoped_ptr<DiveStore> store(storeCreate(conf, outputDir));
+    if (!store.get()) {
+	fail("Unknown storage format '" + conf.storeFormat + "'");
+	return false;
+    }
+
+    try {
+	if (optRebuildIndex && !init) {
+	    Message(prefix) << "Rebuilding dive index...";
+	    store->rebuildIndex();
+	}
+
+	// Load the index before talking to the device to catch
+	// problems with the output directory early.
+	if (!init)
+	    store->getLastDive();
+
+	Callbacks callbacks(*this, *store);
+	device.reset(devCreate(*conf.devInfo, conf.devPort.c_str()));
+	if (!device.get()) {
+	    fail("Device type unsupported");
+	    return false;
+	}
+
+	RetryPolicy retry;
+	retry.retries = optRetries;
+	device->setRetryPolicy(retry);
+
+	device->setCallbackHandler(&callbacks);
+
+	suunto::Vyper *vyper(dynamic_cast<suunto::Vyper *>(device.get()));
+
+	try {
+	    if (vyper)
+		setupDelay(*vyper);
+
+	    device->forEach();
+	} catch (DeviceException e) {
+	    // Running out of time ends the session, but keeps what has
+	    // been received.
+	    if (e.getStatus() != DEVICE_STATUS_CANCELLED || failed() ||
+		!deadline.expired())
+		throw;
+	    cancelled = true;
+	}
+
+	if (cancelled) {
+	    callbacks.keepDives();
+	    fail(deadline.what());
+	} else if (!failed()) {
+	    if (device->getRetries())
+		Message(prefix)
+		    << "Recovered from " << device->getRetries()
+		    << " failed transfers.";
+
+	    Message(prefix) << "Storing dives...";
+	    callbacks.saveDives();
+	    newDives = callbacks.getDiveCount();
+	}
+    } catch (DeviceException e) {
+	// Errors from the callbacks cancel the download, report the
+	// reason instead of the cancellation.
+	fail(e.what());
+    } catch (DiveStoreException e) {
+	fail(e.what());
+    } catch (std::exception &e) {
+	fail(e.what());
+    }
+
+    // Failed downloads are the most interesting ones to measure
+    if (device.get())
+	stats = device->getStats();
+
+    return !failed();
+}
+
+/** Device and logbook configuration of one entry in a fleet file */
+struct FleetEntry {
+    FleetEntry(const bfs::path &dir, bool init)
+	: conf(), session(conf, dir, init), started(false) {}
+
+    DCConf conf;
+    SyncSession session;
+    pthread_t thread;
+    bool started;
+};
+
+typedef std::vector<FleetEntry *> Fleet;
+
+/**
+ * Load a fleet file
+ *
+ * Every non-empty line contains the port, the device type and the
+ * logbook directory of one device, separated by white space. Lines
+ * starting with '#' are ignored. Relative directories are relative to
+ * the directory containing the fleet file.
+ */
+static void
+loadFleet(Fleet &fleet)
+{
+    bfs::ifstream fin(fleetFile);
+    string line;
+    unsigned int lineNo = 0;
+
+    if (!fin) {
+	cerr << "Error: Failed to open fleet file" << endl;
+	exit(EXIT_FAILURE);
+    }
+
+    while (getline(fin, line)) {
+	istringstream ss(line);
+	string port, type, dir, trailing;
+
+	lineNo++;
+	if (!(ss >> port) || port[0] == '#')
+	    continue;
+
+	if (!(ss >> type >> dir) || ss >> trailing) {
+	    cerr << "Error: " << fleetFile.string() << ":" << lineNo
+		 << ": Expected 'PORT TYPE DIR'" << endl;
+	    exit(EXIT_FAILURE);
+	}
+
+	const DeviceInfo *devInfo(getDeviceInfo(type.c_str()));
+	if (!devInfo) {
+	    cerr << "Error: " << fleetFile.string() << ":" << lineNo
+		 << ": Unknown device type '" << type << "'" << endl;
+	    exit(EXIT_FAILURE);
+	}
+
+	bfs::path path(dir);
+	if (!path.is_complete())
+	    path = fleetFile.parent_path() / path;
+
+	// Logbooks that don't exist yet are initialized using the
+	// storage options from the command line.
+	FleetEntry *entry(new FleetEntry(path, !bfs::exists(path)));
+	entry->conf.devPort = port;
+	entry->conf.devInfo = devInfo;
+	entry->conf.storeFormat = dcconf.storeFormat;
+	entry->conf.storeObjects = dcconf.storeObjects;
+	entry->conf.storeCompress = dcconf.storeCompress;
+	entry->session.setName(dir);
+	entry->session.showProgress = true;
+
+	fleet.push_back(entry);
+    }
+
+    if (fleet.empty()) {
+	cerr << "Error: No devices in fleet file" << endl;
 	exit(EXIT_FAILURE);
     }
 }
 
+static void
+reportBatchIo()
+{
+    if (batchIoSaved())
+	cerr << "Batched I/O saved " << batchIoSaved()
+	     << " of " << batchIoOperations() << " system calls." << endl;
+}
+
+static void *
+syncThread(void *arg)
+{
+    SyncSession *session(static_cast<SyncSession *>(arg));
+
+    session->sync();
+
+    return NULL;
+}
+
+/**
+ * Synchronize all devices in a fleet concurrently
+ *
+ * Each device is handled by its own thread since downloads are
+ * limited by the speed of the serial protocol. A device that fails
+ * doesn't affect the other devices.
+ */
+static int
+syncFleet()
+{
+    Fleet fleet;
+    unsigned int failed(0);
+    unsigned int cancelled(0);
+
+    loadFleet(fleet);
+
+    BOOST_FOREACH(FleetEntry *entry, fleet) {
+	SyncSession &session(entry->session);
+
+	if (!session.prepare())
+	    continue;
+
+	if (pthread_create(&entry->thread, NULL, syncThread, &session)) {
+	    session.fail("Failed to create thread");
+	    continue;
+	}
+	entry->started = true;
+    }
+
+    BOOST_FOREACH(FleetEntry *entry, fleet) {
+	if (entry->started)
+	    pthread_join(entry->thread, NULL);
+    }
+
+    cerr << "Summary:" << endl;
+    BOOST_FOREACH(FleetEntry *entry, fleet) {
+	SyncSession &session(entry->session);
+
+	cerr << "  " << session.getPrefix();
+	if (session.failed()) {
+	    cerr << "Error: " << session.getError() << endl;
+	    if (session.isCancelled())
+		cancelled++;
+	    else
+		failed++;
+	} else
+	    cerr << session.getNewDives() << " new dives" << endl;
+    }
+
+    BOOST_FOREACH(FleetEntry *entry, fleet) {
+	entry->session.reportStats();
+	delete entry;
+    }
+
+    reportBatchIo();
+
+    return failed ? 1 : (cancelled ? 2 : 0);
+}
+
 static void
 parse_args(int argc, char **argv)
 {
@@ -256,6 +705,26 @@ parse_args(int argc, char **argv)
 	("help", "produce help message")
 	("force", "don't treat some errors as fatal")
 	("init", "setup directory for device synchronization")
+	("storage", po::value<string>(),
+	 "dive storage format when used with --init (dir, archive or cas)")
+	("objects", po::value<string>(),
+	 "shared object directory for cas storage, used with --init")
+	("compress", "compress stored dives, used with --init")
+	("rebuild-index", "recreate the dive index from the stored dives")
+	("retries", po::value<unsigned int>(),
+	 "number of times a failed download is restarted from the "
+	 "beginning (default 3)")
+	("tune-delay", "find and store the fastest reliable delay between "
+	 "commands (Suunto Vyper)")
+	("fleet", po::value<string>(),
+	 "synchronize all devices listed in a fleet file concurrently")
+	("time-limit", po::value<unsigned int>(),
+	 "cancel a download that takes longer than this many seconds")
+	("dive-time-limit", po::value<unsigned int>(),
+	 "cancel a download if a dive takes longer than this many seconds")
+	("stats", "print transfer statistics")
+	("stats-file", po::value<string>(),
+	 "append transfer statistics to a file as CSV")
 	;
 
     po::options_description optsHidden("Hidden");
@@ -280,11 +749,77 @@ parse_args(int argc, char **argv)
 
 	if (vm.count("help")) {
 	    cout << "Usage: dcsync [OPTION]... [DIR]" << endl;
+	    cout << "   or: dcsync [OPTION]... --fleet FILE" << endl;
 	    cout << optsVisible << endl;
+	    cout << "Each line in a fleet file contains the port, device type "
+		 << "and logbook" << endl
+		 << "directory of one device. Logbooks that don't exist are "
+		 << "initialized." << endl << endl
+		 << "The exit status is 2 if a download ran out of time. "
+		 << "The dives received are" << endl
+		 << "kept and stored by the next session." << endl;
 	    exit(EXIT_SUCCESS);
 	}
 
 	optInit = vm.count("init") > 0;
+	optRebuildIndex = vm.count("rebuild-index") > 0;
+	optTuneDelay = vm.count("tune-delay") > 0;
+
+	if (vm.count("retries"))
+	    optRetries = vm["retries"].as<unsigned int>();
+
+	if (vm.count("time-limit"))
+	    optTimeLimit = vm["time-limit"].as<unsigned int>();
+	if (vm.count("dive-time-limit"))
+	    optDiveTimeLimit = vm["dive-time-limit"].as<unsigned int>();
+
+	optStats = vm.count("stats") > 0;
+	if (vm.count("stats-file"))
+	    optStatsFile = vm["stats-file"].as<string>();
+
+	if (vm.count("fleet")) {
+	    if (optInit || vm.count("output-dir") ||
+		vm.count("dev-port") || vm.count("dev-type")) {
+		cerr << "Error: The logbooks and devices of a fleet are "
+		     << "specified in the fleet file" << endl;
+		exit(EXIT_FAILURE);
+	    }
+	    fleetFile = bfs::complete(vm["fleet"].as<string>());
+	}
+
+	// Storage options apply to new logbooks in a fleet
+	const bool newLogbooks(optInit || !fleetFile.empty());
+
+	if (vm.count("storage")) {
+	    if (!newLogbooks) {
+		cerr << "Error: The storage format can only be set with --init"
+		     << endl;
+		exit(EXIT_FAILURE);
+	    }
+	    dcconf.storeFormat = vm["storage"].as<string>();
+	}
+
+	if (vm.count("objects")) {
+	    if (!newLogbooks) {
+		cerr << "Error: The object directory can only be set with --init"
+		     << endl;
+		exit(EXIT_FAILURE);
+	    }
+	    dcconf.storeObjects = bfs::complete(vm["objects"].as<string>()).string();
+	}
+
+	if (vm.count("compress")) {
+	    if (!newLogbooks) {
+		cerr << "Error: Compression can only be enabled with --init"
+		     << endl;
+		exit(EXIT_FAILURE);
+	    }
+	    if (!haveDiveCompression()) {
+		cerr << "Error: This build doesn't support compression" << endl;
+		exit(EXIT_FAILURE);
+	    }
+	    dcconf.storeCompress = true;
+	}
 
 	if (vm.count("output-dir"))
 	    outputDir = vm["output-dir"].as<string>();
@@ -292,9 +827,6 @@ parse_args(int argc, char **argv)
 	    outputDir = bfs::current_path();
 
 	dcconf.handleArgs(vm);
-
-	configDir = outputDir / bfs::path(".divetools");
-	configFile = configDir / bfs::path("config");
     } catch (po::error e) {
 	cerr << "Error: " << e.what() << endl;
 	exit(EXIT_FAILURE);
@@ -305,68 +837,25 @@ int
 main(int argc, char **argv)
 {
     parse_args(argc, argv);
-    if (optInit) {
-	if (bfs::exists(outputDir)) {
-	    cerr << "Error: Output directory already exists" << endl;
-	    return 1;
-	}
-    } else {
-	if (!bfs::exists(outputDir)) {
-	    cerr << "Error: Output directory does not exist" << endl;
-	    return 1;
-	}
-
-	if (!bfs::exists(configDir)) {
-	    cerr << "Error: Output directory does not exist" << endl;
-	    return 1;
-	}
-    }
 
-    parse_conf();
+    if (!fleetFile.empty())
+	return syncFleet();
 
-    if (!dcconf.devInfo) {
-	cerr << "Error: Unknown device type specified" << endl;
-	return 1;
-    }
+    SyncSession session(dcconf, outputDir, optInit);
 
-    if (dcconf.devPort.empty()) {
-	cerr << "Error: No port specified for device" << endl;
+    if (!session.prepare()) {
+	cerr << "Error: " << session.getError() << endl;
 	return 1;
     }
 
-    if (!optInit) {
-	if (!dcconf.devSerialValid) {
-	    if(!optForce) {
-		cerr << "Error: No serial number specified in configuration." << endl;
-		cerr << "Use --force to ignore this error." << endl;
-		return 1;
-	    } else {
-		cerr << "Warning: No serial number specified in configuration." << endl;
-		cerr << "Warning: Continuing anyway... Good luck!" << endl;
-	    }
-	}
-
-	findLastDive();
+    const bool ok(session.sync());
+    session.reportStats();
+    if (!ok) {
+	cerr << "Error: " << session.getError() << endl;
+	return session.isCancelled() ? 2 : 1;
     }
 
-    try {
-	Callbacks callbacks;
-	boost::scoped_ptr<Device> device;
-	device.reset(devCreate(dcconf.devInfo->device, dcconf.devPort.c_str()));
-	if (!device.get()) {
-	    cerr << "Error: Device type unsupported" << endl;
-	    return 1;
-	}
+    reportBatchIo();
 
-	device->setCallbackHandler(&callbacks);
-
-	device->forEach();
-
-	cerr << "Storing dives..." << endl;
-	callbacks.saveDives();
-    } catch (DeviceException e) {
-	cerr << "Error: " << e.what() << endl;
-	return 1;
-    }
     return 0;
 }
@@ -29,31 +29,67 @@
  */
 
 #include <iostream>
+#include <sstream>
 #include <memory>
+#include <vector>
+#include <cstring>
 
 #include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
 
 #include "dcxx/suunto.hh"
+#include "dcxx/deadline.hh"
+
+#include "dive_store.hh"
 
 using namespace std;
 using namespace dcxx;
 
 namespace po = boost::program_options;
+namespace bfs = boost::filesystem;
 
 #define VYPER_CONFIG_OFFSET 0x1E
 #define VYPER_CONFIG_LEN 0x53
 
 #define VYPER_MEM_SIZE 0x2000
+#define VYPER_PROFILE_END_OFFSET 0x51
+#define VYPER_MODEL_OFFSET 0x24
+#define VYPER_SERIAL_OFFSET 0x26
+#define VYPER_SERIAL_SIZE 4
 
 enum Mode {
     MODE_INFO,
     MODE_RAW_CONFIG,
     MODE_RAW_MEMORY,
+    MODE_TUNE_DELAY,
+    MODE_UPDATE_MEMORY,
 };
 
 /* Configuration options */
 static std::string devPort;
 static Mode optMode = MODE_INFO;
+static bool optCacheStats = false;
+static unsigned int optDelay = 0;
+static unsigned int optRetries = 3;
+static bfs::path optImage;
+static bfs::path optInfoCache;
+static unsigned int optTimeLimit = 0;
+
+/** Cancels the session when it runs out of time */
+class TimeLimit
+    : public DeviceCallbacks
+{
+public:
+    TimeLimit(Deadline &_deadline)
+	: deadline(_deadline) {}
+
+    bool onCancel(Device &device) {
+	return deadline.expired();
+    }
+
+private:
+    Deadline &deadline;
+};
 
 static void
 parse_args(int argc, char **argv)
@@ -63,6 +99,18 @@ parse_args(int argc, char **argv)
 	("help", "produce help message")
 	("raw-config", "dump raw configuration")
 	("raw-memory", "dump dive computer memory")
+	("update-memory", po::value<string>(),
+	 "update a memory dump, reading only what has changed")
+	("tune-delay", "find the fastest reliable delay between commands")
+	("delay", po::value<unsigned int>(),
+	 "delay between commands in ms")
+	("retries", po::value<unsigned int>(),
+	 "number of times a failed read is retried (default 3)")
+	("info-cache", po::value<string>(),
+	 "keep copies of device configurations in a directory")
+	("time-limit", po::value<unsigned int>(),
+	 "give up after this many seconds, exit status 2")
+	("cache-stats", "print memory cache statistics")
 	;
 
     po::options_description optsHidden("Hidden");
@@ -96,12 +144,34 @@ parse_args(int argc, char **argv)
 	if (vm.count("raw-memory") > 0)
 	    optMode = MODE_RAW_MEMORY;
 
-	if (vm.count("raw-memory") &&
-	    vm.count("raw-config")) {
-	    cerr << "Can't both dump memory and raw configuration." << endl;
+	if (vm.count("tune-delay") > 0)
+	    optMode = MODE_TUNE_DELAY;
+	if (vm.count("update-memory") > 0) {
+	    optMode = MODE_UPDATE_MEMORY;
+	    optImage = vm["update-memory"].as<string>();
+	}
+
+	if (vm.count("raw-memory") + vm.count("raw-config") +
+	    vm.count("tune-delay") + vm.count("update-memory") > 1) {
+	    cerr << "Only one of --raw-config, --raw-memory, --update-memory "
+		 << "and --tune-delay can be used." << endl;
 	    exit(EXIT_FAILURE);
 	}
 
+	if (vm.count("delay"))
+	    optDelay = vm["delay"].as<unsigned int>();
+
+	if (vm.count("retries"))
+	    optRetries = vm["retries"].as<unsigned int>();
+
+	optCacheStats = vm.count("cache-stats") > 0;
+
+	if (vm.count("time-limit"))
+	    optTimeLimit = vm["time-limit"].as<unsigned int>();
+
+	if (vm.count("info-cache"))
+	    optInfoCache = vm["info-cache"].as<string>();
+
 	if (vm.count("port"))
 	    devPort = vm["port"].as<string>();
 	else {
@@ -114,9 +184,36 @@ parse_args(int argc, char **argv)
     }
 }
 
+/**
+ * Use a configuration saved by an earlier invocation if the device
+ * hasn't changed since, otherwise save the current configuration.
+ */
+static void
+restoreInfo(suunto::Vyper &vyper)
+{
+    const suunto::Vyper::InfoKey key(vyper.getInfoKey());
+    ostringstream name;
+    name << key.serial << ".info";
+    const bfs::path path(optInfoCache / name.str());
+    vector<char> data;
+
+    if (bfs::exists(path)) {
+	readFile(path, data);
+	if (!data.empty() && vyper.restoreInfo(&data[0], data.size()))
+	    return;
+    }
+
+    vyper.saveInfo(data);
+    bfs::create_directories(optInfoCache);
+    writeFileAtomic(path, &data[0], data.size());
+}
+
 static void
 printInfo(suunto::Vyper &vyper)
 {
+    if (!optInfoCache.empty())
+	restoreInfo(vyper);
+
     cout << "Max depth: " << vyper.getMaxDepth() << endl;
     cout << "Total dive time: " << vyper.getTotalDiveTime() << endl;
     cout << "No dives: " << vyper.getTotalDives() << endl;
@@ -149,13 +246,105 @@ dumpMemory(suunto::Vyper &vyper)
     cout.write(mem, sizeof(mem));
 }
 
+static bool
+validProfileEnd(unsigned int end)
+{
+    return end >= suunto::Vyper::PROFILE_BEGIN &&
+	end < suunto::Vyper::PROFILE_END;
+}
+
+/** Check if two memory headers have the same model and serial number */
+static bool
+sameDevice(const char *a, const char *b)
+{
+    return a[VYPER_MODEL_OFFSET] == b[VYPER_MODEL_OFFSET] &&
+	memcmp(a + VYPER_SERIAL_OFFSET, b + VYPER_SERIAL_OFFSET,
+	       VYPER_SERIAL_SIZE) == 0;
+}
+
+/**
+ * Update a memory dump incrementally
+ *
+ * The header is always read. New dives are written to the profile
+ * ring buffer starting at the end-of-profile marker, so only the part
+ * of the ring buffer between the old and the new marker has to be
+ * read. This assumes that less than a ring buffer's worth of dives
+ * has been made since the dump was last updated. A dump from another
+ * device, according to its model and serial number, is replaced with
+ * a full read.
+ */
+static void
+updateMemory(suunto::Vyper &vyper)
+{
+    const unsigned int begin(suunto::Vyper::PROFILE_BEGIN);
+    const unsigned int end(suunto::Vyper::PROFILE_END);
+    const TransferStats &stats(vyper.getStats());
+    const uint64_t startReads(stats.getReads());
+    const uint64_t startBytes(stats.getReadBytes());
+    vector<char> mem;
+
+    if (bfs::exists(optImage))
+	readFile(optImage, mem);
+
+    unsigned int oldEnd(0);
+    const bool haveImage(mem.size() == VYPER_MEM_SIZE);
+    if (haveImage)
+	oldEnd = ((unsigned char)mem[VYPER_PROFILE_END_OFFSET] << 8) |
+	    (unsigned char)mem[VYPER_PROFILE_END_OFFSET + 1];
+    else
+	mem.assign(VYPER_MEM_SIZE, 0);
+
+    const vector<char> oldHeader(mem.begin(), mem.begin() + begin);
+    vyper.read(0, &mem[0], begin);
+    const unsigned int newEnd(vyper.getProfileEnd());
+
+    // The old dump can only be continued if it came from this device
+    if (haveImage && !sameDevice(&oldHeader[0], &mem[0])) {
+	cerr << "Warning: " << optImage.string() << " was dumped from another "
+	     << "device, reading all of the memory." << endl;
+	oldEnd = 0;
+    }
+
+    vector<ReadRange> ranges;
+    if (!validProfileEnd(oldEnd) || !validProfileEnd(newEnd)) {
+	ranges.push_back(ReadRange(begin, end - begin, &mem[begin]));
+    } else if (newEnd > oldEnd) {
+	ranges.push_back(ReadRange(oldEnd, newEnd - oldEnd + 1, &mem[oldEnd]));
+    } else if (newEnd < oldEnd) {
+	// The new dives wrapped around the end of the ring buffer
+	ranges.push_back(ReadRange(oldEnd, end - oldEnd, &mem[oldEnd]));
+	ranges.push_back(ReadRange(begin, newEnd - begin + 1, &mem[begin]));
+    }
+
+    vyper.readv(ranges);
+    writeFileAtomic(optImage, &mem[0], mem.size());
+
+    // What went over the wire, including the rounding to cache pages
+    // and the gaps readv() bridged
+    cerr << "Read " << stats.getReadBytes() - startBytes << " of "
+	 << VYPER_MEM_SIZE << " bytes in "
+	 << stats.getReads() - startReads << " reads." << endl;
+}
+
 int
 main(int argc, char **argv)
 {
     parse_args(argc, argv);
 
+    Deadline deadline;
+    deadline.setTotal(optTimeLimit);
+    deadline.start();
+    TimeLimit timeLimit(deadline);
+
     try {
 	suunto::Vyper vyper(devPort.c_str());
+	vyper.setCallbackHandler(&timeLimit);
+	if (optDelay)
+	    vyper.setDelay(optDelay);
+
+	RetryPolicy retry;
+	retry.retries = optRetries;
+	vyper.setRetryPolicy(retry);
 
 	switch (optMode) {
 	case MODE_INFO:
@@ -169,10 +358,43 @@ main(int argc, char **argv)
 	case MODE_RAW_MEMORY:
 	    dumpMemory(vyper);
 	    break;
+
+	case MODE_UPDATE_MEMORY:
+	    updateMemory(vyper);
+	    break;
+
+	case MODE_TUNE_DELAY:
+	    cout << "Delay: "
+		 << vyper.tuneDelay(optDelay ? optDelay :
+				    suunto::Vyper::DEFAULT_DELAY)
+		 << " ms" << endl;
+	    break;
+	}
+
+	if (vyper.getRetries())
+	    cerr << "Recovered from " << vyper.getRetries()
+		 << " failed reads." << endl;
+
+	if (optCacheStats) {
+	    const PageCache &cache(vyper.getCache());
+	    cerr << "Cache: " << cache.getHits() << " hits, "
+		 << cache.getMisses() << " misses ("
+		 << cache.getPageSize() << " byte pages)" << endl;
 	}
 
 	return 0;
     } catch (DeviceException e) {
+	if (e.getStatus() == DEVICE_STATUS_CANCELLED && deadline.expired()) {
+	    cerr << "Error: " << deadline.what() << endl;
+	    return 2;
+	}
+	cerr << "Error: " << e.what() << endl;
+	return 1;
+    } catch (DiveStoreException e) {
+	cerr << "Error: " << e.what() << endl;
+	return 1;
+    } catch (std::exception &e) {
+	// Errors from Boost Filesystem, e.g. an unusable --info-cache
 	cerr << "Error: " << e.what() << endl;
 	return 1;
     }
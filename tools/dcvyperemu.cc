@@ -0,0 +1,513 @@
+/*
+ * Copyright (c) 2011, Andreas Sandberg
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials provided
+ *       with the distribution.
+ *
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Suunto Vyper emulator
+ *
+ * Creates a pseudo terminal that speaks the Vyper serial protocol and
+ * serves a memory image, e.g. one dumped with "dcvyper --raw-memory".
+ * The name of the terminal is printed on startup and can be used as
+ * the port of a suunto-vyper device:
+ *
+ *   dcvyperemu memory.bin &
+ *   dcsync --init --dev-type suunto-vyper --dev-port /dev/pts/N logbook
+ *
+ * The emulator models the timing of the serial line (--baud), the
+ * echo sent back by many clone interfaces (--echo) and the time the
+ * dive computer takes to respond to a command (--latency).
+ *
+ * Pseudo terminals don't have modem control lines, so the RTS
+ * switching done by libdivecomputer has no effect. Since the command
+ * is sent before RTS would be cleared and the response is only sent
+ * after the latency has passed, this doesn't affect the protocol as
+ * long as the latency exceeds the time libdivecomputer waits before
+ * flushing the echo (200 ms).
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include <boost/program_options.hpp>
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+#define VYPER_MEM_SIZE 0x2000
+#define VYPER_PACKET_SIZE 32
+
+#define VYPER_EOP_OFFSET 0x51
+#define VYPER_RB_BEGIN 0x71
+#define VYPER_RB_END 0x2000
+#define VYPER_RB_SIZE (VYPER_RB_END - VYPER_RB_BEGIN)
+
+#define VYPER_MARKER_DIVE 0x80
+
+#define CMD_READ 0x05
+#define CMD_WRITE 0x06
+#define CMD_PREPARE_WRITE 0x07
+#define CMD_DIVE_FIRST 0x08
+#define CMD_DIVE_NEXT 0x09
+
+/** Time after which a partial command is discarded, in ms */
+#define COMMAND_TIMEOUT 500
+
+/* Configuration options */
+static string optImage;
+static string optLink;
+static unsigned int optBaud = 2400;
+static bool optEcho = false;
+static unsigned int optLatency = 500;
+static bool optVerbose = false;
+
+static vector<unsigned char> memory;
+static int master = -1;
+
+/** Start of the last dive that was sent, walking backwards */
+static unsigned int divePos;
+/** Number of ring buffer bytes sent as dives so far */
+static unsigned int diveBytes;
+
+static void
+parse_args(int argc, char **argv)
+{
+    po::options_description optsGeneral("General options");
+    optsGeneral.add_options()
+	("help", "produce help message")
+	("baud", po::value<unsigned int>(),
+	 "emulated line speed (default 2400)")
+	("echo", "echo commands like a clone interface")
+	("latency", po::value<unsigned int>(),
+	 "time before responding to a command in ms (default 500)")
+	("link", po::value<string>(),
+	 "create a symbolic link to the pseudo terminal")
+	("verbose", "log commands")
+	;
+
+    po::options_description optsHidden("Hidden");
+    optsHidden.add_options()
+	("image", po::value<string>(), "");
+
+    po::options_description optsAll;
+    optsAll.add(optsGeneral).add(optsHidden);
+
+    po::positional_options_description args;
+    args.add("image", 1);
+
+    po::variables_map vm;
+
+    try {
+	po::store(po::command_line_parser(argc, argv).
+		  options(optsAll).positional(args).run(), vm);
+	po::notify(vm);
+
+	if (vm.count("help")) {
+	    cout << "Usage: dcvyperemu [OPTION]... IMAGE" << endl;
+	    cout << optsGeneral << endl;
+	    exit(EXIT_SUCCESS);
+	}
+
+	if (vm.count("baud")) {
+	    optBaud = vm["baud"].as<unsigned int>();
+	    if (!optBaud) {
+		cerr << "Error: Invalid baud rate" << endl;
+		exit(EXIT_FAILURE);
+	    }
+	}
+
+	if (vm.count("latency"))
+	    optLatency = vm["latency"].as<unsigned int>();
+
+	if (vm.count("link"))
+	    optLink = vm["link"].as<string>();
+
+	optEcho = vm.count("echo") > 0;
+	optVerbose = vm.count("verbose") > 0;
+
+	if (vm.count("image"))
+	    optImage = vm["image"].as<string>();
+	else {
+	    cerr << "Error: No memory image specified" << endl;
+	    exit(EXIT_FAILURE);
+	}
+    } catch (po::error e) {
+	cerr << "Error: " << e.what() << endl;
+	exit(EXIT_FAILURE);
+    }
+}
+
+static void
+loadImage()
+{
+    ifstream fin(optImage.c_str(), ios::in | ios::binary);
+    if (!fin) {
+	cerr << "Error: Failed to open memory image" << endl;
+	exit(EXIT_FAILURE);
+    }
+
+    memory.assign(istreambuf_iterator<char>(fin),
+		  istreambuf_iterator<char>());
+    if (memory.size() != VYPER_MEM_SIZE) {
+	cerr << "Error: Memory image has the wrong size" << endl;
+	exit(EXIT_FAILURE);
+    }
+}
+
+static void
+openTerminal()
+{
+    struct termios tio;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+	cerr << "Error: Failed to create pseudo terminal: "
+	     << strerror(errno) << endl;
+	exit(EXIT_FAILURE);
+    }
+
+    // The emulator deals with raw bytes
+    if (tcgetattr(master, &tio) == 0) {
+	cfmakeraw(&tio);
+	tcsetattr(master, TCSANOW, &tio);
+    }
+
+    const string slave(ptsname(master));
+    if (!optLink.empty()) {
+	unlink(optLink.c_str());
+	if (symlink(slave.c_str(), optLink.c_str()) == -1) {
+	    cerr << "Error: Failed to create link: " << strerror(errno)
+		 << endl;
+	    exit(EXIT_FAILURE);
+	}
+    }
+
+    cout << slave << endl;
+}
+
+static unsigned char
+checksum(const unsigned char *data, unsigned int size)
+{
+    unsigned char crc = 0;
+    for (unsigned int i = 0; i < size; i++)
+	crc ^= data[i];
+    return crc;
+}
+
+/**
+ * Read one byte from the terminal
+ *
+ * @param timeout Time to wait in ms, or -1 to wait forever
+ * @return false on timeout
+ */
+static bool
+readByte(unsigned char &c, int timeout)
+{
+    while (true) {
+	fd_set fds;
+	struct timeval tv;
+
+	FD_ZERO(&fds);
+	FD_SET(master, &fds);
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	const int ret(select(master + 1, &fds, NULL, NULL,
+			     timeout < 0 ? NULL : &tv));
+	if (ret == 0)
+	    return false;
+	else if (ret == -1) {
+	    if (errno == EINTR)
+		continue;
+	    cerr << "Error: " << strerror(errno) << endl;
+	    exit(EXIT_FAILURE);
+	}
+
+	const ssize_t n(::read(master, &c, 1));
+	if (n == 1)
+	    return true;
+	else if (n == -1 && (errno == EINTR || errno == EAGAIN))
+	    continue;
+
+	// Reading from the master fails with EIO while no one has the
+	// slave open, wait for a client.
+	usleep(100000);
+    }
+}
+
+/** Time to transfer a number of bytes at the emulated line speed */
+static void
+lineDelay(unsigned int bytes)
+{
+    // 8O1: start bit, 8 data bits, parity and stop bit
+    const unsigned long long us(bytes * 11ULL * 1000000 / optBaud);
+    if (us)
+	usleep(us);
+}
+
+static void
+send(const unsigned char *data, unsigned int size)
+{
+    lineDelay(size);
+
+    while (size > 0) {
+	const ssize_t n(::write(master, data, size));
+	if (n == -1) {
+	    if (errno == EINTR || errno == EAGAIN)
+		continue;
+	    // The client went away, it will retry
+	    return;
+	}
+	data += n;
+	size -= n;
+    }
+}
+
+/** Read the rest of a command, false if it's incomplete or corrupt */
+static bool
+readCommand(vector<unsigned char> &cmd, unsigned int size)
+{
+    unsigned char c;
+
+    while (cmd.size() < size) {
+	if (!readByte(c, COMMAND_TIMEOUT))
+	    return false;
+	cmd.push_back(c);
+    }
+
+    lineDelay(size);
+    if (optEcho)
+	send(&cmd[0], cmd.size());
+
+    return checksum(&cmd[0], size - 1) == cmd[size - 1];
+}
+
+static void
+respond(const vector<unsigned char> &answer)
+{
+    usleep(optLatency * 1000);
+    send(&answer[0], answer.size());
+}
+
+static void
+cmdRead(vector<unsigned char> &cmd)
+{
+    if (!readCommand(cmd, 5))
+	return;
+
+    const unsigned int addr((cmd[1] << 8) | cmd[2]);
+    const unsigned int len(cmd[3]);
+    if (len > VYPER_PACKET_SIZE || addr + len > memory.size())
+	return;
+
+    if (optVerbose)
+	cerr << "Read " << len << " bytes at 0x" << hex << addr << dec
+	     << endl;
+
+    vector<unsigned char> answer(cmd.begin(), cmd.begin() + 4);
+    answer.insert(answer.end(),
+		  memory.begin() + addr, memory.begin() + addr + len);
+    answer.push_back(checksum(&answer[0], answer.size()));
+    respond(answer);
+}
+
+static void
+cmdPrepareWrite(vector<unsigned char> &cmd)
+{
+    if (!readCommand(cmd, 3))
+	return;
+
+    if (optVerbose)
+	cerr << "Prepare write" << endl;
+
+    respond(cmd);
+}
+
+static void
+cmdWrite(vector<unsigned char> &cmd)
+{
+    unsigned char c;
+
+    // The length is needed to know the size of the command
+    while (cmd.size() < 4) {
+	if (!readByte(c, COMMAND_TIMEOUT))
+	    return;
+	cmd.push_back(c);
+    }
+
+    const unsigned int addr((cmd[1] << 8) | cmd[2]);
+    const unsigned int len(cmd[3]);
+    if (len > VYPER_PACKET_SIZE || !readCommand(cmd, len + 5) ||
+	addr + len > memory.size())
+	return;
+
+    if (optVerbose)
+	cerr << "Write " << len << " bytes at 0x" << hex << addr << dec
+	     << endl;
+
+    copy(cmd.begin() + 4, cmd.begin() + 4 + len, memory.begin() + addr);
+
+    vector<unsigned char> answer(cmd.begin(), cmd.begin() + 4);
+    answer.push_back(checksum(&answer[0], answer.size()));
+    respond(answer);
+}
+
+static unsigned int
+ringPrev(unsigned int pos)
+{
+    return pos == VYPER_RB_BEGIN ? VYPER_RB_END - 1 : pos - 1;
+}
+
+/**
+ * Find the next older dive in the profile ring buffer
+ *
+ * Dives start with a marker byte. The newest dive ends at the
+ * end-of-profile pointer and every other dive ends where the next
+ * newer one starts.
+ */
+static void
+nextDive(vector<unsigned char> &dive)
+{
+    dive.clear();
+
+    unsigned int pos(divePos);
+    while (diveBytes < VYPER_RB_SIZE) {
+	pos = ringPrev(pos);
+	diveBytes++;
+	dive.push_back(memory[pos]);
+
+	if (memory[pos] == VYPER_MARKER_DIVE) {
+	    divePos = pos;
+	    return;
+	}
+    }
+
+    // Ran out of ring buffer without finding the start of a dive
+    dive.clear();
+}
+
+static void
+cmdDive(vector<unsigned char> &cmd)
+{
+    vector<unsigned char> dive;
+
+    if (!readCommand(cmd, 3))
+	return;
+
+    if (cmd[0] == CMD_DIVE_FIRST) {
+	divePos = (memory[VYPER_EOP_OFFSET] << 8) |
+	    memory[VYPER_EOP_OFFSET + 1];
+	diveBytes = 0;
+	if (divePos < VYPER_RB_BEGIN || divePos >= VYPER_RB_END)
+	    diveBytes = VYPER_RB_SIZE;
+    }
+
+    // The dive is sent backwards, which is the order it's found in
+    // when walking backwards from the end of the profile.
+    nextDive(dive);
+
+    if (optVerbose)
+	cerr << "Dive of " << dive.size() << " bytes" << endl;
+
+    usleep(optLatency * 1000);
+
+    // The end of the dives is signalled by an empty package
+    unsigned int pos(0);
+    do {
+	const unsigned int len(min<size_t>(dive.size() - pos,
+					   VYPER_PACKET_SIZE));
+	vector<unsigned char> package;
+
+	package.push_back(cmd[0]);
+	package.push_back(len);
+	package.insert(package.end(),
+		       dive.begin() + pos, dive.begin() + pos + len);
+	package.push_back(checksum(&package[0], package.size()));
+	send(&package[0], package.size());
+
+	pos += len;
+    } while (pos < dive.size());
+}
+
+int
+main(int argc, char **argv)
+{
+    parse_args(argc, argv);
+    loadImage();
+    openTerminal();
+
+    diveBytes = VYPER_RB_SIZE;
+
+    while (true) {
+	vector<unsigned char> cmd;
+	unsigned char c;
+
+	readByte(c, -1);
+	cmd.push_back(c);
+
+	switch (c) {
+	case CMD_READ:
+	    cmdRead(cmd);
+	    break;
+
+	case CMD_PREPARE_WRITE:
+	    cmdPrepareWrite(cmd);
+	    break;
+
+	case CMD_WRITE:
+	    cmdWrite(cmd);
+	    break;
+
+	case CMD_DIVE_FIRST:
+	case CMD_DIVE_NEXT:
+	    cmdDive(cmd);
+	    break;
+
+	default:
+	    // Unknown commands and line noise are ignored, like the
+	    // dive computer does.
+	    if (optVerbose)
+		cerr << "Ignoring 0x" << hex << (int)c << dec << endl;
+	    break;
+	}
+    }
+
+    return 0;
+}